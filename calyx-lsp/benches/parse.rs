@@ -0,0 +1,308 @@
+//! Parsing throughput of the tree-sitter grammar that calyx-lsp uses, and of
+//! the `calyx-frontend` parser, over real and generated Calyx designs.
+//!
+//! Run with `cargo bench -p calyx-lsp --bench parse`. Criterion reports
+//! throughput in bytes per second; the peak memory used by one parse of each
+//! input is printed before its benchmark runs.
+//!
+//! The `document-edit` group measures what a keystroke costs before the
+//! reparse: the text and line-index updates of `Document::edit`.
+
+use calyx_frontend::parser::CalyxParser;
+use criterion::{
+    criterion_group, criterion_main, BatchSize, BenchmarkId, Criterion,
+    Throughput,
+};
+use std::fmt::Write;
+use std::fs;
+use std::path::Path;
+use std::sync::Arc;
+use tower_lsp::lsp_types as lspt;
+use tree_sitter as ts;
+
+#[allow(dead_code)]
+#[path = "../src/line_index.rs"]
+mod line_index;
+
+use line_index::LineIndex;
+
+extern "C" {
+    fn tree_sitter_calyx() -> ts::Language;
+}
+
+/// Sizes of the generated designs, in bytes
+const GENERATED_SIZES: &[usize] = &[1 << 10, 64 << 10, 1 << 20, 50 << 20];
+
+/// The frontend keeps a copy of every file that it parses, so it is only
+/// benchmarked on inputs up to this size.
+const FRONTEND_MAX_SIZE: usize = 1 << 20;
+
+struct Input {
+    name: String,
+    text: String,
+}
+
+/// The components in `benches/component-sharing`, every file under
+/// `primitives/`, and generated designs of each of `GENERATED_SIZES`.
+fn corpus() -> Vec<Input> {
+    let root = Path::new(env!("CARGO_MANIFEST_DIR")).join("..");
+    let mut paths = vec![];
+    for dir in [
+        "benches/component-sharing",
+        "primitives",
+        "primitives/memories",
+    ] {
+        let mut files = fs::read_dir(root.join(dir))
+            .unwrap()
+            .map(|entry| entry.unwrap().path())
+            .filter(|path| path.extension().map_or(false, |e| e == "futil"))
+            .collect::<Vec<_>>();
+        files.sort();
+        paths.extend(files);
+    }
+
+    paths
+        .into_iter()
+        .map(|path| Input {
+            name: path.file_name().unwrap().to_string_lossy().to_string(),
+            text: fs::read_to_string(&path).unwrap(),
+        })
+        .chain(GENERATED_SIZES.iter().map(|&size| Input {
+            name: format!("generated-{}", human_size(size)),
+            text: generate(size),
+        }))
+        .collect()
+}
+
+/// Generate a design of at least `size` bytes out of small counter
+/// components.
+fn generate(size: usize) -> String {
+    let mut text = String::with_capacity(size + 1024);
+    let mut i = 0;
+    while text.len() < size {
+        writeln!(
+            text,
+            r#"component comp{i}(in: 32) -> (out: 32) {{
+  cells {{
+    r{i} = std_reg(32);
+    a{i} = std_add(32);
+    lt{i} = std_lt(32);
+  }}
+  wires {{
+    group incr{i} {{
+      a{i}.left = r{i}.out;
+      a{i}.right = 32'd1;
+      r{i}.in = a{i}.out;
+      r{i}.write_en = 1'd1;
+      incr{i}[done] = r{i}.done;
+    }}
+    comb group cond{i} {{
+      lt{i}.left = r{i}.out;
+      lt{i}.right = in;
+    }}
+    out = r{i}.out;
+  }}
+  control {{
+    seq {{
+      incr{i};
+      while lt{i}.out with cond{i} {{
+        incr{i};
+      }}
+    }}
+  }}
+}}"#
+        )
+        .unwrap();
+        i += 1;
+    }
+    text
+}
+
+fn human_size(size: usize) -> String {
+    match size {
+        s if s >= 1 << 20 => format!("{}MB", s >> 20),
+        s => format!("{}KB", s >> 10),
+    }
+}
+
+fn parser() -> ts::Parser {
+    let mut parser = ts::Parser::new();
+    parser.set_language(unsafe { tree_sitter_calyx() }).unwrap();
+    parser
+}
+
+/// Read a `kB` field of `/proc/self/status`, in bytes.
+fn proc_status(field: &str) -> Option<usize> {
+    fs::read_to_string("/proc/self/status")
+        .ok()?
+        .lines()
+        .find_map(|line| line.strip_prefix(field)?.strip_prefix(':'))?
+        .trim()
+        .strip_suffix(" kB")?
+        .parse::<usize>()
+        .ok()
+        .map(|kb| kb * 1024)
+}
+
+/// Run `f` and return how far the resident set size of the process grew
+/// above what it was before, at its peak. This counts the C allocations of
+/// tree-sitter as well as Rust ones, but is only supported on Linux, where
+/// the peak can be reset through `/proc/self/clear_refs`.
+fn peak_memory<T>(f: impl FnOnce() -> T) -> Option<usize> {
+    fs::write("/proc/self/clear_refs", "5").ok()?;
+    let before = proc_status("VmHWM")?;
+    let result = f();
+    let after = proc_status("VmHWM")?;
+    drop(result);
+    Some(after.saturating_sub(before))
+}
+
+fn report_memory(group: &str, name: &str, peak: Option<usize>) {
+    match peak {
+        Some(bytes) => {
+            println!("{group}/{name}: peak memory {} KB", bytes >> 10)
+        }
+        None => println!("{group}/{name}: peak memory unavailable"),
+    }
+}
+
+fn tree_sitter_bench(c: &mut Criterion) {
+    let mut group = c.benchmark_group("tree-sitter");
+    group.sample_size(10);
+    for input in corpus() {
+        let mut parser = parser();
+        let peak = peak_memory(|| parser.parse(&input.text, None).unwrap());
+        report_memory("tree-sitter", &input.name, peak);
+
+        group.throughput(Throughput::Bytes(input.text.len() as u64));
+        group.bench_with_input(
+            BenchmarkId::from_parameter(&input.name),
+            &input.text,
+            |b, text| b.iter(|| parser.parse(text, None).unwrap()),
+        );
+    }
+    group.finish();
+}
+
+/// Latency of reparsing after a single small edit in the middle of a file,
+/// which is what the language server does on every keystroke.
+fn incremental_bench(c: &mut Criterion) {
+    let mut group = c.benchmark_group("tree-sitter-edit");
+    group.sample_size(10);
+    for input in corpus().into_iter().filter(|i| i.text.len() >= 1 << 10) {
+        let mut parser = parser();
+        let tree = parser.parse(&input.text, None).unwrap();
+
+        // insert a comment at the start of the line in the middle of the text
+        let start_byte = input.text[..input.text.len() / 2]
+            .rfind('\n')
+            .map_or(0, |idx| idx + 1);
+        let inserted = "// edit\n";
+        let mut text = input.text.clone();
+        text.insert_str(start_byte, inserted);
+        let row = input.text[..start_byte].matches('\n').count();
+        let edit = ts::InputEdit {
+            start_byte,
+            old_end_byte: start_byte,
+            new_end_byte: start_byte + inserted.len(),
+            start_position: ts::Point::new(row, 0),
+            old_end_position: ts::Point::new(row, 0),
+            new_end_position: ts::Point::new(row + 1, 0),
+        };
+
+        group.bench_with_input(
+            BenchmarkId::from_parameter(&input.name),
+            &text,
+            |b, text| {
+                b.iter_batched(
+                    || {
+                        let mut tree = tree.clone();
+                        tree.edit(&edit);
+                        tree
+                    },
+                    |tree| parser.parse(text, Some(&tree)).unwrap(),
+                    BatchSize::SmallInput,
+                )
+            },
+        );
+    }
+    group.finish();
+}
+
+/// The text side of `Document::edit`, for typing one character at `at`:
+/// copy the text if a parse job still shares it, splice it, and update the
+/// line index.
+fn type_char(
+    text: &mut Arc<String>,
+    lines: &mut LineIndex,
+    at: lspt::Position,
+) {
+    let start = lines.offset(text, at);
+    Arc::make_mut(text).replace_range(start..start, "x");
+    lines.edit(start, start, "x");
+}
+
+/// Latency of the text and line-index updates for one typed character in
+/// the middle of a large file. `shared` runs it while the previous text is
+/// still held, as it is by a parse job that hasn't finished.
+fn document_edit_bench(c: &mut Criterion) {
+    let mut group = c.benchmark_group("document-edit");
+    group.sample_size(10);
+    for input in corpus().into_iter().filter(|i| i.text.len() >= 1 << 20) {
+        let lines = LineIndex::new(&input.text);
+        let at = lines.position(&input.text, input.text.len() / 2);
+        for shared in [false, true] {
+            let name = match shared {
+                true => format!("{}-shared", input.name),
+                false => input.name.clone(),
+            };
+            group.bench_function(BenchmarkId::from_parameter(name), |b| {
+                b.iter_batched(
+                    || {
+                        (
+                            Arc::new(input.text.clone()),
+                            LineIndex::new(&input.text),
+                        )
+                    },
+                    |(mut text, mut lines)| {
+                        let snapshot = shared.then(|| Arc::clone(&text));
+                        type_char(&mut text, &mut lines, at);
+                        (text, lines, snapshot)
+                    },
+                    BatchSize::LargeInput,
+                )
+            });
+        }
+    }
+    group.finish();
+}
+
+fn frontend_bench(c: &mut Criterion) {
+    let mut group = c.benchmark_group("calyx-frontend");
+    group.sample_size(10);
+    for input in corpus()
+        .into_iter()
+        .filter(|i| i.text.len() <= FRONTEND_MAX_SIZE)
+    {
+        let peak =
+            peak_memory(|| CalyxParser::parse(input.text.as_bytes()).unwrap());
+        report_memory("calyx-frontend", &input.name, peak);
+
+        group.throughput(Throughput::Bytes(input.text.len() as u64));
+        group.bench_with_input(
+            BenchmarkId::from_parameter(&input.name),
+            &input.text,
+            |b, text| b.iter(|| CalyxParser::parse(text.as_bytes()).unwrap()),
+        );
+    }
+    group.finish();
+}
+
+criterion_group!(
+    parse,
+    tree_sitter_bench,
+    incremental_bench,
+    document_edit_bench,
+    frontend_bench
+);
+criterion_main!(parse);
@@ -12,4 +12,57 @@ fn main() {
 
     c_config.compile("parser");
     println!("cargo:rerun-if-changed={}", parser_path.to_str().unwrap());
+
+    // the on-disk index cache is only valid for the grammar that built it
+    let parser = std::fs::read(&parser_path).unwrap();
+    let fingerprint = parser.iter().fold(0xcbf29ce484222325u64, |h, &b| {
+        (h ^ b as u64).wrapping_mul(0x100000001b3)
+    });
+    println!("cargo:rustc-env=CALYX_GRAMMAR_FINGERPRINT={fingerprint:016x}");
+
+    let out_dir = std::path::PathBuf::from(std::env::var("OUT_DIR").unwrap());
+    std::fs::write(
+        out_dir.join("symbols.rs"),
+        symbol_consts(&String::from_utf8(parser).unwrap()),
+    )
+    .unwrap();
+}
+
+/// The entries of the C initializer in `parser` that starts with `header`,
+/// as `(lhs, rhs)` pairs of entries of the form `lhs = rhs,`.
+fn initializer<'a>(parser: &'a str, header: &str) -> Vec<(&'a str, &'a str)> {
+    let start = parser.find(header).unwrap() + header.len();
+    let end = start + parser[start..].find("};").unwrap();
+    parser[start..end]
+        .lines()
+        .filter_map(|line| line.trim().trim_end_matches(',').split_once(" = "))
+        .collect()
+}
+
+/// Generate a constant for the id of every named node kind of the grammar,
+/// so that tree walks can compare `Node::kind_id`s rather than kind names.
+fn symbol_consts(parser: &str) -> String {
+    let values: std::collections::HashMap<_, _> =
+        initializer(parser, "enum {").into_iter().collect();
+    let public: std::collections::HashMap<_, _> =
+        initializer(parser, "ts_symbol_map[] = {")
+            .into_iter()
+            .map(|(sym, public)| (sym.trim_matches(&['[', ']'][..]), public))
+            .collect();
+
+    let mut consts = String::from("// Generated by build.rs from parser.c\n");
+    let mut seen = std::collections::HashSet::new();
+    for (sym, name) in initializer(parser, "ts_symbol_names[] = {") {
+        let sym = sym.trim_matches(&['[', ']'][..]);
+        let name = name.trim_matches('"');
+        // anonymous and auxiliary symbols never show up as named nodes
+        if !sym.starts_with("sym_") || !seen.insert(name) {
+            continue;
+        }
+        // kind ids are the public symbol, which several aliases can share
+        let id = values[public[sym]];
+        consts +=
+            &format!("pub const {}: u16 = {id};\n", name.to_ascii_uppercase());
+    }
+    consts
 }
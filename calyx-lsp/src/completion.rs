@@ -1,13 +1,11 @@
-use std::path::PathBuf;
-
-use itertools::{multizip, Itertools};
+use calyx_utils::Id;
+use itertools::Itertools;
 use tower_lsp::lsp_types as lspt;
 
 use crate::{
     convert::Point,
     document::{Context, Document},
-    query_result::QueryResult,
-    Config,
+    symbols::{SymbolIndex, SymbolKind},
 };
 
 #[derive(Clone, Debug)]
@@ -56,220 +54,109 @@ impl From<CompletionItem> for lspt::CompletionItem {
     }
 }
 
-#[derive(Clone, Debug)]
-pub enum CompletionRes {
-    Found(Vec<CompletionItem>),
-    ContinuePort(Vec<PathBuf>, String),
-    ContinueComponent(Vec<PathBuf>, Vec<CompletionItem>),
-}
-
-impl QueryResult for CompletionRes {
-    type Data = Vec<CompletionItem>;
-    type Needle = String;
-
-    fn found(&self) -> Option<Self::Data> {
-        match self {
-            CompletionRes::Found(data) => Some(data.clone()),
-            CompletionRes::ContinuePort(..)
-            | CompletionRes::ContinueComponent(..) => None,
-        }
-    }
-
-    fn paths(&self) -> Vec<PathBuf> {
-        match self {
-            CompletionRes::Found(_) => vec![],
-            CompletionRes::ContinuePort(paths, _) => paths.clone(),
-            CompletionRes::ContinueComponent(paths, _) => paths.clone(),
-        }
-    }
-
-    fn resume(&self, config: &Config, doc: &Document) -> Option<Self> {
-        match self {
-            CompletionRes::Found(_) => Some(self.clone()),
-            CompletionRes::ContinuePort(_, name) => doc
-                .signatures()
-                .find(|(n, _)| name == n)
-                .map(|(_, sig)| {
-                    Self::Found(
-                        sig.inputs
-                            .iter()
-                            .map(|inp| (inp, "input"))
-                            .chain(
-                                sig.outputs.iter().map(|out| (out, "output")),
-                            )
-                            .map(|(name, descr)| {
-                                CompletionItem::simple(name, descr)
-                            })
-                            .collect(),
-                    )
-                })
-                .or_else(|| {
-                    Some(Self::ContinuePort(
-                        doc.resolved_imports(config).collect(),
-                        name.to_string(),
-                    ))
-                }),
-            CompletionRes::ContinueComponent(paths, compls) => {
-                let mut imports =
-                    doc.resolved_imports(config).collect::<Vec<_>>();
-                let paths = &paths[1..];
-                let comps_here = doc
-                    .root_node()
-                    .map(|root| {
-                        let prims = doc.captures(
-                            root,
-                            "(primitive (ident) @name (params (ident) @param))",
-                        );
-                        let comps =
-                            doc.captures(root, "(component (ident) @name)");
-                        multizip((prims["name"].iter(), prims["param"].iter()))
-                            .map(|(n, p)| (doc.node_text(n), doc.node_text(p)))
-                            .group_by(|(n, _)| n.to_string())
-                            .into_iter()
-                            .map(|(n, p)| {
-                                CompletionItem::snippet(
-                                    n.to_string(),
-                                    "primitive",
-                                    format!(
-                                        "{n}({});",
-                                        p.enumerate()
-                                            .map(|(i, (_, y))| format!(
-                                                "${{{}:{y}}}",
-                                                i + 1
-                                            ))
-                                            .join(", ")
-                                    ),
-                                )
-                            })
-                            .chain(compls.clone())
-                            .chain(
-                                comps["name"]
-                                    .iter()
-                                    .map(|n| doc.node_text(n))
-                                    .map(|n| {
-                                        CompletionItem::snippet(
-                                            n,
-                                            "component",
-                                            format!("{n}();"),
-                                        )
-                                    }),
-                            )
-                            .collect()
-                    })
-                    .unwrap_or_default();
-                Some(if paths.is_empty() && imports.is_empty() {
-                    Self::Found(comps_here)
-                } else {
-                    imports.extend_from_slice(paths);
-                    Self::ContinueComponent(imports, comps_here)
-                })
-            }
-        }
-    }
-}
-
 pub trait CompletionProvider {
     fn complete(
         &self,
+        index: &SymbolIndex,
         trigger_char: Option<&str>,
         point: &Point,
-        config: &Config,
-    ) -> Option<Vec<CompletionRes>>;
+    ) -> Option<Vec<CompletionItem>>;
 }
 
 impl CompletionProvider for Document {
     fn complete(
         &self,
+        index: &SymbolIndex,
         trigger_char: Option<&str>,
         point: &Point,
-        config: &Config,
-    ) -> Option<Vec<CompletionRes>> {
+    ) -> Option<Vec<CompletionItem>> {
         self.last_word_from_point(point).and_then(|word| {
             self.node_at_point(point).and_then(|node| {
                 match (self.context_at_point(point), trigger_char) {
                     (Context::Toplevel, _) => {
-                        Some(vec![CompletionRes::Found(vec![CompletionItem::snippet(
+                        Some(vec![CompletionItem::snippet(
                             "component",
                             "block",
                             "component $1($2) -> ($3) {\n  cells {}\n  wires {}\n  control {}\n}",
-                        )])])
+                        )])
                     }
                     (Context::Component, _) => None,
-                    (Context::Cells, _) => Some(vec![
-                        CompletionRes::Found(
-                            self.components
-                                .keys()
-                                .map(|k| CompletionItem::snippet(k, "component", format!("{k}();")))
-                                .collect(),
-                        ),
-                        CompletionRes::ContinueComponent(
-                            self.resolved_imports(config).collect(),
-                            vec![],
-                        ),
-                    ]),
+                    (Context::Cells, _) => Some(
+                        index
+                            .complete(&self.url, self.prefix_at_point(point))
+                            .into_iter()
+                            .map(|(name, symbol)| match symbol.kind {
+                                SymbolKind::Primitive => CompletionItem::snippet(
+                                    name,
+                                    "primitive",
+                                    format!(
+                                        "{name}({});",
+                                        symbol
+                                            .params
+                                            .iter()
+                                            .enumerate()
+                                            .map(|(i, p)| format!("${{{}:{p}}}", i + 1))
+                                            .join(", ")
+                                    ),
+                                ),
+                                SymbolKind::Component => CompletionItem::snippet(
+                                    name,
+                                    "component",
+                                    format!("{name}();"),
+                                ),
+                            })
+                            .collect(),
+                    ),
                     (Context::Group, Some(".")) | (Context::Wires, Some(".")) => self
                         .enclosing_component_name(node)
                         .and_then(|comp_name| self.components.get(&comp_name))
-                        .and_then(|ci| ci.cells.get(&word))
-                        .and_then(|cell_name| {
-                            self.components
-                                .get(cell_name)
-                                .map(|ci| {
-                                    vec![CompletionRes::Found(
-                                        ci.signature.inputs
-                                            .iter()
-                                            .map(|i| CompletionItem::simple(i, "input"))
-                                            .chain(
-                                                ci.signature.outputs
-                                                    .iter()
-                                                    .map(|o| CompletionItem::simple(o, "output")),
-                                            )
-                                            .collect(),
-                                    )]
-                                })
-                                .or_else(|| {
-                                    Some(vec![CompletionRes::ContinuePort(
-                                        self.resolved_imports(config).collect(),
-                                        cell_name.to_string(),
-                                    )])
-                                })
+                        .and_then(|ci| ci.cells.get(&Id::new(&word)))
+                        .and_then(|cell_type| index.find(&self.url, cell_type))
+                        .map(|(_, symbol)| {
+                            symbol
+                                .signature
+                                .inputs
+                                .iter()
+                                .map(|i| CompletionItem::simple(i, "input"))
+                                .chain(
+                                    symbol
+                                        .signature
+                                        .outputs
+                                        .iter()
+                                        .map(|o| CompletionItem::simple(o, "output")),
+                                )
+                                .collect()
                         }),
                     (Context::Group, _) => self
                         .enclosing_component_name(node)
                         .and_then(|comp_name| self.components.get(&comp_name))
                         .map(|ci| {
-                            vec![CompletionRes::Found(
-                                ci.cells
-                                    .keys()
-                                    .map(|g| CompletionItem::simple(g, "cell"))
-                                    .chain(ci.groups.iter().map(|g| {
-                                        CompletionItem::snippet(g, "hole", format!("{g}[$1]"))
-                                    }))
-                                    .collect(),
-                            )]
+                            ci.cells
+                                .keys()
+                                .map(|g| CompletionItem::simple(g, "cell"))
+                                .chain(ci.groups.iter().map(|g| {
+                                    CompletionItem::snippet(g, "hole", format!("{g}[$1]"))
+                                }))
+                                .collect()
                         }),
                     (Context::Wires, _) => self
                         .enclosing_component_name(node)
                         .and_then(|comp_name| self.components.get(&comp_name))
                         .map(|ci| {
-                            vec![CompletionRes::Found(
-                                ci.cells
-                                    .keys()
-                                    .map(|g| CompletionItem::simple(g, "cell"))
-                                    .collect(),
-                            )]
+                            ci.cells
+                                .keys()
+                                .map(|g| CompletionItem::simple(g, "cell"))
+                                .collect()
                         }),
 
                     (Context::Control, _) => self
                         .enclosing_component_name(node)
                         .and_then(|comp_name| self.components.get(&comp_name))
                         .map(|ci| {
-                            vec![CompletionRes::Found(
-                                ci.groups
-                                    .iter()
-                                    .map(|g| CompletionItem::simple(g, "group"))
-                                    .collect(),
-                            )]
+                            ci.groups
+                                .iter()
+                                .map(|g| CompletionItem::simple(g, "group"))
+                                .collect()
                         }),
                 }
             })
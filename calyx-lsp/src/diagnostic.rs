@@ -1,6 +1,18 @@
-use std::path::Path;
+use std::collections::HashMap;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::{Arc, Mutex, RwLock};
+use std::thread;
+use std::time::{Duration, Instant};
 
 use resolve_path::PathResolveExt;
+use tokio::sync::Semaphore;
+use tower_lsp::lsp_types as lspt;
+use tower_lsp::Client;
+
+use crate::document::SharedDocument;
+use crate::log;
+use crate::stats;
 
 pub struct Diagnostic;
 
@@ -36,3 +48,149 @@ impl Diagnostic {
         })
     }
 }
+
+/// How long to wait for more requests for the same file before running the
+/// compiler. Saving several times in quick succession only runs once.
+const DEBOUNCE: Duration = Duration::from_millis(200);
+
+/// Runs diagnostics in the background so that requests never wait on the
+/// compiler.
+///
+/// Every request for a file gets a new generation number. A run only
+/// continues past each of its waits (debouncing, waiting for a free
+/// compiler slot, and waiting for a blocking thread to start the compiler
+/// on) if no newer request for the same file has arrived in the meantime;
+/// otherwise it stops there. The compiler can't be interrupted once it has
+/// started, so a run that is superseded while compiling finishes, and its
+/// results are dropped. Runs for different files proceed in parallel on
+/// the blocking thread pool, limited to one per available core.
+pub struct DiagnosticsWorker {
+    /// Connection to the client that is used for publishing diagnostics
+    client: Client,
+    /// Open documents, used to translate error offsets into positions
+    open_docs: Arc<RwLock<HashMap<lspt::Url, SharedDocument>>>,
+    /// The latest generation requested for each file that has a run
+    /// pending. The latest run removes its file's entry when it is done.
+    generations: Mutex<HashMap<lspt::Url, u64>>,
+    next_generation: AtomicU64,
+    /// Limits the number of concurrent compiler runs
+    slots: Semaphore,
+}
+
+impl DiagnosticsWorker {
+    pub fn new(
+        client: Client,
+        open_docs: Arc<RwLock<HashMap<lspt::Url, SharedDocument>>>,
+    ) -> Arc<Self> {
+        let slots = thread::available_parallelism().map_or(1, |n| n.get());
+        Arc::new(Self {
+            client,
+            open_docs,
+            generations: Mutex::new(HashMap::default()),
+            next_generation: AtomicU64::new(0),
+            slots: Semaphore::new(slots),
+        })
+    }
+
+    /// Request that diagnostics for `url` are computed, with libraries at
+    /// `lib_path`, and published. Supersedes any earlier request for `url`
+    /// that hasn't been published yet.
+    pub fn schedule(self: &Arc<Self>, url: lspt::Url, lib_path: PathBuf) {
+        let generation = self.next_generation.fetch_add(1, Ordering::Relaxed);
+        self.generations
+            .lock()
+            .unwrap()
+            .insert(url.clone(), generation);
+        let worker = Arc::clone(self);
+        tokio::spawn(async move {
+            Arc::clone(&worker)
+                .run(url.clone(), lib_path, generation)
+                .await;
+            worker.retire(&url, generation);
+        });
+    }
+
+    /// Is `generation` still the latest request for `url`?
+    fn is_current(&self, url: &lspt::Url, generation: u64) -> bool {
+        self.generations.lock().unwrap().get(url) == Some(&generation)
+    }
+
+    /// Forget `url` once the run for `generation` is done, unless a newer
+    /// request has replaced it
+    fn retire(&self, url: &lspt::Url, generation: u64) {
+        let mut generations = self.generations.lock().unwrap();
+        if generations.get(url) == Some(&generation) {
+            generations.remove(url);
+        }
+    }
+
+    async fn run(
+        self: Arc<Self>,
+        url: lspt::Url,
+        lib_path: PathBuf,
+        generation: u64,
+    ) {
+        tokio::time::sleep(DEBOUNCE).await;
+        if !self.is_current(&url, generation) {
+            return;
+        }
+        // measured from the end of the debounce, so this includes the
+        // wait for a compiler slot
+        let _timer = stats::timer("textDocument/publishDiagnostics");
+        let Ok(_slot) = self.slots.acquire().await else {
+            return;
+        };
+        let Ok(path) = url.to_file_path() else {
+            return;
+        };
+        let worker = Arc::clone(&self);
+        let file = url.clone();
+        let Ok(Some(errors)) = tokio::task::spawn_blocking(move || {
+            // the blocking pool may not start this right away
+            worker
+                .is_current(&file, generation)
+                .then(|| Diagnostic::did_save(&path, &lib_path))
+        })
+        .await
+        else {
+            return;
+        };
+        if !self.is_current(&url, generation) {
+            return;
+        }
+
+        let start = Instant::now();
+        let doc = self.open_docs.read().unwrap().get(&url).cloned();
+        stats::lock_wait("openDocs", start);
+        let diags = match doc {
+            Some(doc) => {
+                let start = Instant::now();
+                let doc = doc.read().await;
+                stats::lock_wait("document", start);
+                errors
+                    .into_iter()
+                    .filter_map(|diag| {
+                        doc.lsp_position(diag.pos_start).and_then(|s| {
+                            doc.lsp_position(diag.pos_end)
+                                .map(|e| (lspt::Range::new(s, e), diag.msg))
+                        })
+                    })
+                    .map(|(range, message)| lspt::Diagnostic {
+                        range,
+                        severity: Some(lspt::DiagnosticSeverity::ERROR),
+                        code: None,
+                        code_description: None,
+                        source: Some("calyx".to_string()),
+                        message,
+                        related_information: None,
+                        tags: None,
+                        data: None,
+                    })
+                    .inspect(|diag| log::debug!("{diag:#?}"))
+                    .collect()
+            }
+            None => vec![],
+        };
+        self.client.publish_diagnostics(url, diags, None).await;
+    }
+}
@@ -1,44 +1,80 @@
 //! Represents a single Calyx file
 
 use std::collections::HashMap;
+use std::ops;
 use std::path::PathBuf;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+
+use calyx_utils::Id;
 
 use itertools::{multizip, Itertools};
 use regex::Regex;
-use resolve_path::PathResolveExt;
 use tower_lsp::lsp_types as lspt;
 use tree_sitter as ts;
 
 use crate::convert::{Contains, Point, Range};
+use crate::library;
+use crate::line_index::LineIndex;
 use crate::log;
+use crate::node_kind;
+use crate::parsers;
+use crate::queries::{self, Captures};
+use crate::stats;
+use crate::symbols::{FileSymbols, Symbol, SymbolKind};
 use crate::ts_utils::ParentUntil;
-use crate::{tree_sitter_calyx, Config};
+
+/// An open document. Every document has its own lock, so that requests for
+/// one document never wait on changes to another.
+pub type SharedDocument = Arc<tokio::sync::RwLock<Document>>;
 
 pub struct Document {
     pub url: lspt::Url,
-    text: String,
+    /// The text of the document. It is shared with any parse job that is
+    /// still running, and only copied if it is edited in the meantime.
+    text: Arc<String>,
+    /// Where each line of `text` starts
+    lines: LineIndex,
     tree: Option<ts::Tree>,
-    parser: ts::Parser,
+    /// Byte ranges of `text` that have been edited since the last parse.
+    edited: Vec<ops::Range<usize>>,
+    /// Incremented whenever `text` changes
+    version: u64,
+    /// Cancellation flag of the latest parse job
+    cancel: Arc<AtomicUsize>,
     /// Map the stores information about every component defined in this file.
-    pub components: HashMap<String, ComponentInfo>,
+    pub components: HashMap<Id, ComponentInfo>,
+    /// The components and primitives that this file defines
+    pub symbols: FileSymbols,
 }
 
 /// Public information about a component
-#[derive(Debug)]
+#[derive(Debug, Default)]
 pub struct ComponentSig {
-    pub inputs: Vec<String>,
-    pub outputs: Vec<String>,
+    pub inputs: Vec<Id>,
+    pub outputs: Vec<Id>,
 }
 
 /// File-private information about each component
-#[derive(Debug)]
+///
+/// Definition ranges are byte ranges relative to the start of the
+/// component, so that they stay valid when an edit elsewhere in the file
+/// moves the component.
+#[derive(Debug, Default)]
 pub struct ComponentInfo {
     /// the signature of this component
-    pub signature: ComponentSig,
+    pub signature: Arc<ComponentSig>,
     /// map from cell names to component names
-    pub cells: HashMap<String, String>,
+    pub cells: HashMap<Id, Id>,
     /// the names of groups in this component
-    pub groups: Vec<String>,
+    pub groups: Vec<Id>,
+    /// where each port of the signature is defined
+    pub port_defs: HashMap<Id, ops::Range<usize>>,
+    /// where each cell is defined
+    pub cell_defs: HashMap<Id, ops::Range<usize>>,
+    /// where each group is defined
+    pub group_defs: HashMap<Id, ops::Range<usize>>,
 }
 
 #[derive(Clone, Debug)]
@@ -76,222 +112,417 @@ pub trait NodeRangesIter<'a>: Iterator<Item = ts::Node<'a>> + Sized {
 impl Document {
     /// Create an empty document for `url`.
     pub fn new(url: lspt::Url) -> Self {
-        let mut parser = ts::Parser::new();
-        parser.set_language(unsafe { tree_sitter_calyx() }).unwrap();
         Self {
             url,
-            text: String::new(),
+            text: Arc::default(),
+            lines: LineIndex::default(),
             tree: None,
-            parser,
+            edited: vec![],
+            version: 0,
+            cancel: Arc::default(),
             components: HashMap::default(),
+            symbols: FileSymbols::default(),
         }
     }
 
     /// Create a new document with `text` for `url`.
-    pub fn new_with_text(url: lspt::Url, text: &str) -> Self {
+    pub fn new_with_text(url: lspt::Url, text: String) -> Self {
         let mut doc = Self::new(url);
         doc.parse_whole_text(text);
         doc
     }
 
     /// Update the document with a with entirely new text.
-    pub fn parse_whole_text(&mut self, text: &str) {
-        self.text = text.to_string();
-        self.tree = self.parser.parse(text, None);
-        self.update_component_map();
-        log::Debug::update(
-            "tree",
-            self.tree.as_ref().unwrap().root_node().to_sexp(),
-        )
+    pub fn parse_whole_text(&mut self, text: String) {
+        self.set_text(text);
+        self.reparse();
     }
 
-    /// Returns the root `treesit` node.
-    pub fn root_node(&self) -> Option<ts::Node> {
-        self.tree.as_ref().map(|t| t.root_node())
+    /// Replace the text of the document, dropping the current tree. Does
+    /// not reparse.
+    pub fn set_text(&mut self, text: String) {
+        self.lines = LineIndex::new(&text);
+        self.text = Arc::new(text);
+        self.tree = None;
+        self.edited.clear();
+        self.version += 1;
     }
 
-    /// Translate a `byte_offset` into a `Point`.
-    pub fn byte_to_point(&self, byte_offset: usize) -> Option<Point> {
-        if byte_offset == 0 {
-            Some(Point::zero())
-        } else if byte_offset < self.text.len() {
-            let portion = &self.text[..byte_offset];
-            let lines = portion.lines();
-            let line_num = lines.clone().count();
-            let res = lines.last().map(|l| Point::new(line_num - 1, l.len()));
-            log::stdout!("{byte_offset} -> {res:?}");
-            res
-        } else {
-            None
+    /// Apply a batch of `textDocument/didChange` events, in order. Ranged
+    /// events are mirrored into the existing tree with `ts::Tree::edit` so
+    /// that tree-sitter can reuse every subtree outside of the edited
+    /// regions. An event without a range replaces the whole text and forces
+    /// a parse from scratch. Does not reparse; see `start_parse`.
+    pub fn apply_changes(
+        &mut self,
+        changes: &[lspt::TextDocumentContentChangeEvent],
+    ) {
+        for change in changes {
+            match change.range {
+                Some(range) => self.edit(range, &change.text),
+                None => self.set_text(change.text.clone()),
+            }
         }
+        self.version += 1;
     }
 
-    /// Compile `pattern` into a treesit query, run the query,
-    /// and return a map of capture names to captured nodes.
-    pub fn captures<'a, 'node: 'a>(
-        &'a self,
-        node: ts::Node<'node>,
-        pattern: &str,
-    ) -> HashMap<String, Vec<ts::Node>> {
-        // create the struct that manages query state
-        let mut cursor = ts::QueryCursor::new();
-        // create the query from the passed in pattern
-        let lang = unsafe { tree_sitter_calyx() };
-        let query = ts::Query::new(lang, pattern)
-            .unwrap_or_else(|err| panic!("Invalid Query:\n{}", err.message));
-        // grab the @ capture names so that we can map idxes back to names
-        let capture_names = query.capture_names();
-
-        // run the query and gather the results in a map from capture names
-        // to the nodes they capture
-        let mut map = HashMap::default();
-
-        // initialize all the capture names so that it's always safe
-        // to query the map for a name that shows up in a pattern
-        for name in capture_names {
-            map.insert(name.to_string(), vec![]);
+    /// Replace the text in `range` with `new_text`, recording the edit in
+    /// the current tree. Does not reparse.
+    ///
+    /// This is linear in the size of the file: splicing `text` moves
+    /// everything after the edit, `LineIndex::edit` shifts every later line
+    /// start, and if a parse job still holds the text, the whole file is
+    /// copied first. For one typed character in the middle of a generated
+    /// file (the `document-edit` group of `benches/parse.rs`), that is about
+    /// 0.2ms at 4MB and 3.4ms at 50MB, and 0.6ms and 30ms while a parse job
+    /// holds the text. Files of a few MB stay under a millisecond, which is
+    /// why the text is a flat `String` rather than a rope; files in the tens
+    /// of MB pay the copy on every keystroke typed during a parse.
+    fn edit(&mut self, range: lspt::Range, new_text: &str) {
+        let start_byte = self.lines.offset(&self.text, range.start);
+        // clients should never send a reversed range, but make sure we
+        // don't panic if one does
+        let old_end_byte =
+            self.lines.offset(&self.text, range.end).max(start_byte);
+        let start_position = self.lines.point(start_byte);
+        let old_end_position = self.lines.point(old_end_byte);
+
+        let new_end_byte = start_byte + new_text.len();
+        Arc::make_mut(&mut self.text)
+            .replace_range(start_byte..old_end_byte, new_text);
+        self.lines.edit(start_byte, old_end_byte, new_text);
+        let new_end_position = self.lines.point(new_end_byte);
+        self.record_edit(start_byte, old_end_byte, new_end_byte);
+        if let Some(tree) = self.tree.as_mut() {
+            tree.edit(&ts::InputEdit {
+                start_byte,
+                old_end_byte,
+                new_end_byte,
+                start_position,
+                old_end_position,
+                new_end_position,
+            });
         }
+    }
 
-        for qmatch in cursor.matches(&query, node, self.text.as_bytes()) {
-            for capture in qmatch.captures {
-                map.entry(capture_names[capture.index as usize].to_string())
-                    .and_modify(|e: &mut Vec<ts::Node>| {
-                        e.extend(&[capture.node])
-                    })
-                    .or_insert(vec![capture.node]);
+    /// Move the ranges edited since the last parse through an edit that
+    /// replaced `start..old_end` with `start..new_end`, and then add the
+    /// range of the edit itself. Ranges that overlap the edit are merged
+    /// into it.
+    fn record_edit(&mut self, start: usize, old_end: usize, new_end: usize) {
+        let mut merged = start..new_end;
+        self.edited.retain_mut(|range| {
+            if range.start > old_end {
+                // entirely after the edit; shift it over
+                range.start = range.start - old_end + new_end;
+                range.end = range.end - old_end + new_end;
+                true
+            } else if range.end < start {
+                // entirely before the edit; nothing moves
+                true
+            } else {
+                merged.start = merged.start.min(range.start);
+                merged.end =
+                    merged.end.max(range.end.saturating_sub(old_end) + new_end);
+                false
             }
+        });
+        self.edited.push(merged);
+    }
+
+    /// Parse the current text, reusing the current tree if there is one.
+    fn reparse(&mut self) {
+        let old_tree = self.tree.take();
+        let start = Instant::now();
+        self.tree =
+            parsers::checkout().parse(self.text.as_bytes(), old_tree.as_ref());
+        stats::parsed(self.text.len(), start);
+        self.installed_tree(old_tree.as_ref());
+    }
+
+    /// Prepare a parse of the current text that can run without access to
+    /// the document, giving up after `budget` (no limit if it is zero). Any
+    /// parse job that is still running for an older text is cancelled, since
+    /// its result is stale.
+    ///
+    /// The budget only applies to incremental parses. Until the document has
+    /// a tree there is nothing to keep serving queries with, and a budget
+    /// would leave a file whose full parse takes longer without a tree for
+    /// good, so the first parse only stops if it is cancelled.
+    pub fn start_parse(&mut self, budget: Duration) -> ParseJob {
+        self.cancel.store(1, Ordering::Relaxed);
+        self.cancel = Arc::default();
+        ParseJob {
+            version: self.version,
+            text: Arc::clone(&self.text),
+            old_tree: self.tree.clone(),
+            cancel: Arc::clone(&self.cancel),
+            budget: if self.tree.is_some() {
+                budget
+            } else {
+                Duration::ZERO
+            },
         }
-        map
     }
 
-    /// Update the component map for this document.
-    fn update_component_map(&mut self) {
-        self.components = self
-            .root_node()
-            .into_iter()
-            .flat_map(|root| {
-                // capture relevant sections of every component
-                // in this file
-                let map = self.captures(
-                    root,
-                    r#"(component (ident) @comp
-                         (signature (io_port_list) @inputs
-                                    (io_port_list) @outputs)
-                         (cells) @cells
-                         (wires) @wires)"#,
-                );
+    /// Install the tree produced by a parse job. Results for an older text
+    /// are dropped. If the job didn't produce a tree, because it ran out of
+    /// time or was cancelled, the current tree keeps serving queries and the
+    /// edits since it was parsed are kept for the next parse.
+    pub fn finish_parse(&mut self, parsed: Parsed) {
+        if parsed.version != self.version {
+            return;
+        }
+        let Some(tree) = parsed.tree else {
+            log::debug!("parse of {} didn't finish", self.url);
+            return;
+        };
+        let old_tree = self.tree.replace(tree);
+        self.installed_tree(old_tree.as_ref());
+    }
 
-                // create an iterator over all the captured nodes.
-                // we are guaranteed that there will be the same
-                // number of each of these
-                multizip((
-                    map["comp"].iter(),
-                    map["inputs"].iter(),
-                    map["outputs"].iter(),
-                    map["cells"].iter(),
-                    map["wires"].iter(),
-                ))
-                .map(|(comp, inputs, outputs, cells, wires)| {
-                    (
-                        // the name of the component
-                        self.node_text(comp).to_string(),
-                        // construct the component info from captured nodes
-                        ComponentInfo {
-                            signature: ComponentSig {
-                                inputs: self.captures(*inputs, "(ident) @id")["id"]
-                                    .iter()
-                                    .map(|n| self.node_text(n).to_string())
-                                    .collect(),
-                                outputs: self.captures(*outputs, "(ident) @id")["id"]
-                                    .iter()
-                                    .map(|n| self.node_text(n).to_string())
-                                    .collect(),
-                            },
-                            cells: {
-                                let cells = self.captures(
-                                    *cells,
-                                    "(cell_assignment (ident) @name (instantiation (ident) @cell))",
-                                );
-                                multizip((cells["name"].iter(), cells["cell"].iter()))
-                                    .map(|(name, cell)| {
-                                        (
-                                            self.node_text(name).to_string(),
-                                            self.node_text(cell).to_string(),
-                                        )
-                                    })
-                                    .collect()
-                            },
-                            groups: self.captures(*wires, "(group (ident) @id)")["id"]
-                                .iter()
-                                .map(|n| self.node_text(n).to_string())
-                                .collect(),
-                        },
-                    )
-                })
-                .collect_vec()
-            })
-            .collect();
+    /// Bring everything that is derived from the tree up to date after the
+    /// tree has replaced `old_tree`.
+    fn installed_tree(&mut self, old_tree: Option<&ts::Tree>) {
+        self.update_component_map(old_tree);
+        log::update(log::Level::Trace, "tree", || {
+            self.root_node()
+                .map(|root| root.to_sexp())
+                .unwrap_or_default()
+        });
     }
 
-    /// Return an iterator over components or primitives
-    pub fn components(&self) -> impl Iterator<Item = ts::Node> {
-        self.root_node().into_iter().flat_map(|root| {
-            self.captures(
-                root,
-                "(component (ident) @comp) (primitive (ident) @comp)",
-            )["comp"]
-                .clone()
-        })
+    /// Returns the root `treesit` node.
+    pub fn root_node(&self) -> Option<ts::Node> {
+        self.tree.as_ref().map(|t| t.root_node())
+    }
+
+    /// Translate a `byte_offset` into an LSP position.
+    pub fn lsp_position(&self, byte_offset: usize) -> Option<lspt::Position> {
+        (byte_offset <= self.text.len())
+            .then(|| self.lines.position(&self.text, byte_offset))
     }
 
-    /// Find all the names of cells for the component that contains `node`
-    pub fn enclosing_cells<'a>(
+    /// Translate an LSP `position` into a `Point`.
+    pub fn point_from_lsp(&self, position: lspt::Position) -> Point {
+        self.lines
+            .point(self.lines.offset(&self.text, position))
+            .into()
+    }
+
+    /// Return the LSP range covered by `node`.
+    pub fn lsp_range(&self, node: &ts::Node) -> lspt::Range {
+        self.lsp_range_of(node.byte_range())
+    }
+
+    /// Return the LSP range covering the bytes in `bytes`.
+    pub fn lsp_range_of(&self, bytes: ops::Range<usize>) -> lspt::Range {
+        lspt::Range::new(
+            self.lines.position(&self.text, bytes.start),
+            self.lines.position(&self.text, bytes.end),
+        )
+    }
+
+    /// Run the query `pattern` on `node` and return the captured nodes
+    /// grouped by capture name. Queries are compiled once and cached.
+    pub fn captures<'a, 'node: 'a>(
         &'a self,
-        node: ts::Node<'a>,
-    ) -> impl Iterator<Item = ts::Node<'a>> {
-        node.parent_until(|n| n.kind() == "component")
-            .into_iter()
-            .flat_map(|comp_node| {
-                // XXX: should be able to avoid this clone somehow
-                self.captures(comp_node, "(cell_assignment (ident) @cell)")
-                    ["cell"]
-                    .clone()
+        node: ts::Node<'node>,
+        pattern: &'static str,
+    ) -> Captures<'a> {
+        stats::query(pattern);
+        queries::run(pattern, node, self.text.as_bytes())
+    }
+
+    /// Update the component map and symbols for this document after a parse.
+    ///
+    /// Components that weren't touched by an edit since the last parse, and
+    /// whose structure didn't change between `old_tree` and the current tree,
+    /// keep their existing entries. Only the rest are recomputed. Without an
+    /// `old_tree` every component is recomputed.
+    fn update_component_map(&mut self, old_tree: Option<&ts::Tree>) {
+        let mut old_components = std::mem::take(&mut self.components);
+        let mut dirty = std::mem::take(&mut self.edited);
+        match (old_tree, self.tree.as_ref()) {
+            // the edits themselves don't always change the structure of the
+            // tree (e.g. renaming a cell), so we have to look at both
+            (Some(old_tree), Some(tree)) => dirty.extend(
+                old_tree
+                    .changed_ranges(tree)
+                    .map(|r| r.start_byte..r.end_byte),
+            ),
+            // without an old tree, there is nothing to reuse
+            _ => old_components.clear(),
+        }
+        let is_dirty = |node: &ts::Node| {
+            dirty.iter().any(|range| {
+                range.start <= node.end_byte() && node.start_byte() <= range.end
             })
+        };
+
+        let mut components = HashMap::with_capacity(old_components.len());
+        let mut symbols = HashMap::default();
+        let children = self
+            .root_node()
+            .map(|root| root.named_children(&mut root.walk()).collect_vec())
+            .unwrap_or_default();
+        for child in children {
+            let comp_nodes = match child.kind_id() {
+                node_kind::COMPONENT => vec![child],
+                node_kind::PRIMITIVE | node_kind::EXTERN => {
+                    symbols.extend(self.primitive_symbols(child));
+                    continue;
+                }
+                // only components, or the errors that a broken component
+                // parses into, can define components
+                _ if child.has_error() || is_dirty(&child) => self
+                    .captures(child, "(component) @comp")
+                    .remove("comp")
+                    .unwrap_or_default(),
+                _ => continue,
+            };
+            for comp in comp_nodes {
+                let Some(ident) = first_ident(comp) else {
+                    continue;
+                };
+                let name = self.node_id(&ident);
+                let info = match old_components.remove(&name) {
+                    Some(info) if !is_dirty(&comp) => info,
+                    _ => self.component_info(comp),
+                };
+                symbols.insert(
+                    name,
+                    Symbol {
+                        kind: SymbolKind::Component,
+                        signature: Arc::clone(&info.signature),
+                        params: vec![],
+                        range: self.lsp_range(&ident),
+                    },
+                );
+                components.insert(name, info);
+            }
+        }
+        self.components = components;
+        self.symbols = Arc::new(symbols);
     }
 
-    /// Find all group names for the component that contains `node`
-    pub fn enclosing_groups<'a>(
-        &'a self,
-        node: ts::Node<'a>,
-    ) -> impl Iterator<Item = ts::Node<'a>> {
-        node.parent_until(|n| n.kind() == "component")
-            .into_iter()
-            .flat_map(|comp_node| {
-                self.captures(comp_node, "(group (ident) @group)")["group"]
-                    .clone()
+    /// Compute the component info for the component `comp`.
+    fn component_info(&self, comp: ts::Node) -> ComponentInfo {
+        let start = comp.start_byte();
+        let relative = |node: &ts::Node| {
+            node.start_byte() - start..node.end_byte() - start
+        };
+        let mut info = ComponentInfo::default();
+        for section in comp.named_children(&mut comp.walk()) {
+            match section.kind_id() {
+                node_kind::SIGNATURE => {
+                    let (signature, ports) = self.signature(section);
+                    info.signature = Arc::new(signature);
+                    info.port_defs = ports
+                        .iter()
+                        .map(|port| (self.node_id(port), relative(port)))
+                        .collect();
+                }
+                node_kind::CELLS => {
+                    let cells = self.captures(
+                        section,
+                        "(cell_assignment (ident) @name (instantiation (ident) @cell))",
+                    );
+                    for (name, cell) in
+                        multizip((cells["name"].iter(), cells["cell"].iter()))
+                    {
+                        let id = self.node_id(name);
+                        info.cells.insert(id, self.node_id(cell));
+                        info.cell_defs.insert(id, relative(name));
+                    }
+                }
+                node_kind::WIRES => {
+                    for group in
+                        &self.captures(section, "(group (ident) @id)")["id"]
+                    {
+                        let id = self.node_id(group);
+                        info.groups.push(id);
+                        info.group_defs.insert(id, relative(group));
+                    }
+                }
+                _ => (),
+            }
+        }
+        info
+    }
+
+    /// Compute the symbols for the primitives in `node`, which is either a
+    /// primitive or an extern block of primitives.
+    fn primitive_symbols(&self, node: ts::Node) -> Vec<(Id, Symbol)> {
+        self.captures(node, "(primitive) @prim")["prim"]
+            .iter()
+            .filter_map(|prim| {
+                let ident = first_ident(*prim)?;
+                let mut symbol = Symbol {
+                    kind: SymbolKind::Primitive,
+                    signature: Arc::default(),
+                    params: vec![],
+                    range: self.lsp_range(&ident),
+                };
+                for section in prim.named_children(&mut prim.walk()) {
+                    match section.kind_id() {
+                        node_kind::SIGNATURE => {
+                            symbol.signature =
+                                Arc::new(self.signature(section).0);
+                        }
+                        node_kind::PARAMS => {
+                            symbol.params = section
+                                .named_children(&mut section.walk())
+                                .map(|param| self.node_id(&param))
+                                .collect();
+                        }
+                        _ => (),
+                    }
+                }
+                Some((self.node_id(&ident), symbol))
             })
+            .collect()
     }
 
-    /// Find all input/output ports for the component that contains `node`
-    pub fn enclosing_component_ports<'a>(
+    /// Read the signature in `node`. Also returns the nodes that name each
+    /// port.
+    fn signature<'a>(
         &'a self,
         node: ts::Node<'a>,
-    ) -> impl Iterator<Item = ts::Node<'a>> {
-        node.parent_until(|n| n.kind() == "component")
-            .into_iter()
-            .flat_map(|comp_node| {
-                self.captures(comp_node, "(io_port (ident) @port)")["port"]
-                    .clone()
+    ) -> (ComponentSig, Vec<ts::Node<'a>>) {
+        let mut lists = node
+            .named_children(&mut node.walk())
+            .filter(|n| n.kind_id() == node_kind::IO_PORT_LIST)
+            .map(|list| {
+                self.captures(list, "(io_port (ident) @id . (_))")
+                    .remove("id")
+                    .unwrap_or_default()
             })
+            .collect_vec()
+            .into_iter();
+        let inputs = lists.next().unwrap_or_default();
+        let outputs = lists.next().unwrap_or_default();
+        let signature = ComponentSig {
+            inputs: inputs.iter().map(|n| self.node_id(n)).collect(),
+            outputs: outputs.iter().map(|n| self.node_id(n)).collect(),
+        };
+        (signature, inputs.into_iter().chain(outputs).collect())
     }
 
     /// Find the name of the component that contains `node`
-    pub fn enclosing_component_name(&self, node: ts::Node) -> Option<String> {
-        node.parent_until(|n| n.kind() == "component")
-            .and_then(|comp_node| {
-                self.captures(comp_node, "(component (ident) @name)")["name"]
-                    .first()
-                    .map(|n| self.node_text(n).to_string())
+    pub fn enclosing_component_name(&self, node: ts::Node) -> Option<Id> {
+        self.enclosing_component(node).map(|(name, _)| name)
+    }
+
+    /// Find the component that contains `node`. Returns its name and its
+    /// node.
+    pub fn enclosing_component<'a>(
+        &'a self,
+        node: ts::Node<'a>,
+    ) -> Option<(Id, ts::Node<'a>)> {
+        node.parent_until_kinds(&[node_kind::COMPONENT])
+            .and_then(|comp| {
+                first_ident(comp).map(|n| (self.node_id(&n), comp))
             })
     }
 
@@ -312,9 +543,8 @@ impl Document {
     /// Resolve the imports into full paths
     pub fn resolved_imports<'a>(
         &'a self,
-        config: &'a Config,
+        lib_paths: &'a [String],
     ) -> impl Iterator<Item = PathBuf> + 'a {
-        let lib_paths = &config.calyx_lsp.library_paths;
         let cur_dir = self
             .url
             .to_file_path()
@@ -322,54 +552,9 @@ impl Document {
             .parent()
             .unwrap()
             .to_path_buf();
-        self.raw_imports()
-            .into_iter()
-            .cartesian_product(
-                vec![cur_dir]
-                    .into_iter()
-                    .chain(lib_paths.iter().map(PathBuf::from)),
-            )
-            .map(|(base_path, lib_path)| {
-                lib_path.join(base_path).resolve().into_owned()
-            })
-            .filter(|p| p.exists())
-    }
-
-    /// Return signatures for all components
-    pub fn signatures(
-        &self,
-    ) -> impl Iterator<Item = (String, ComponentSig)> + '_ {
-        self.components()
-            .filter_map(|comp_node| {
-                comp_node
-                    .parent_until_names(&["component", "primitive"])
-                    .map(|p| (p, self.node_text(&comp_node)))
-            })
-            .flat_map(move |(comp_node, name)| {
-                let mut map = self.captures(
-                    comp_node,
-                    "(signature (io_port_list) @inputs (io_port_list) @outputs)",
-                );
-                multizip((
-                    map.remove("inputs").unwrap().into_iter(),
-                    map.remove("outputs").unwrap().into_iter(),
-                ))
-                .map(move |(inputs, outputs)| {
-                    (
-                        name.to_string(),
-                        ComponentSig {
-                            inputs: self.captures(inputs, "(io_port (ident) @id . (_))")["id"]
-                                .iter()
-                                .map(|n| self.node_text(n).to_string())
-                                .collect(),
-                            outputs: self.captures(outputs, "(io_port (ident) @id . (_))")["id"]
-                                .iter()
-                                .map(|n| self.node_text(n).to_string())
-                                .collect(),
-                        },
-                    )
-                })
-            })
+        self.raw_imports().into_iter().flat_map(move |import| {
+            library::resolve_import(&cur_dir, &import, lib_paths)
+        })
     }
 
     /// Find the treesit node at `point`
@@ -384,8 +569,9 @@ impl Document {
 
     /// Find the semantic thing that is under `point`
     pub fn thing_at_point(&self, point: Point) -> Option<Things> {
-        self.node_at_point(&point).and_then(|node| {
-            if node.parent().is_some_and(|p| p.kind() == "port") {
+        let node = self.node_at_point(&point)?;
+        match node.parent()?.kind_id() {
+            node_kind::PORT => {
                 // when our parent is a port and we have a next sibling
                 // we are looking at a cell. if we don't have a next
                 // sibling, we are looking at a port on our current component
@@ -399,11 +585,13 @@ impl Document {
                 } else {
                     None
                 }
-            } else if node.parent().is_some_and(|p| p.kind() == "enable") {
+            }
+            node_kind::ENABLE => {
                 // if we are in an enable control statement, we are looking
                 // at a group
                 Some(Things::Group(node, self.node_text(&node).to_string()))
-            } else if node.parent().is_some_and(|p| p.kind() == "hole") {
+            }
+            node_kind::HOLE => {
                 // if we are looking at the first part of a hole, we are looking
                 // at a group name
                 if node.next_sibling().is_some() {
@@ -411,23 +599,24 @@ impl Document {
                 } else {
                     None
                 }
-            } else if node.parent().is_some_and(|p| p.kind() == "port_with") {
+            }
+            node_kind::PORT_WITH => {
                 // inside a control `with` statement, we are looking at a group
                 Some(Things::Group(node, self.node_text(&node).to_string()))
-            } else if node.parent().is_some_and(|p| p.kind() == "instantiation")
-            {
+            }
+            node_kind::INSTANTIATION => {
                 // inside a cell instantiation, we are looking at a component
                 Some(Things::Component(self.node_text(&node).to_string()))
-            } else if node.parent().is_some_and(|p| p.kind() == "import") {
+            }
+            node_kind::IMPORT => {
                 // inside an import, we are ofc looking at an import
                 Some(Things::Import(
                     node,
                     self.node_text(&node).to_string().replace('"', ""),
                 ))
-            } else {
-                None
             }
-        })
+            _ => None,
+        }
     }
 
     /// Find the context of the thing at point
@@ -442,10 +631,10 @@ impl Document {
                 // if `n` is a component. we want to capture things
                 // from `n`. otherwise, we find the parent component,
                 // and capture things from there
-                if n.kind() == "component" {
+                if n.kind_id() == node_kind::COMPONENT {
                     Some(n)
                 } else {
-                    n.parent_until_names(&["component"])
+                    n.parent_until_kinds(&[node_kind::COMPONENT])
                 }
             })
             .map(|comp| {
@@ -483,8 +672,73 @@ impl Document {
         })
     }
 
+    /// Return the identifier that ends at `point`, if any. Unlike
+    /// `last_word_from_point`, this is empty when there is whitespace
+    /// between the last word and `point`.
+    pub fn prefix_at_point(&self, point: &Point) -> &str {
+        let end = self.lines.byte(&self.text, point.clone().into());
+        let start = self.text[..end]
+            .rfind(|c: char| !(c.is_alphanumeric() || c == '_'))
+            .map_or(0, |idx| idx + 1);
+        &self.text[start..end]
+    }
+
     /// Return text string for `node`.
     pub fn node_text(&self, node: &ts::Node) -> &str {
-        node.utf8_text(self.text.as_bytes()).unwrap()
+        // while a parse is pending, the tree may not line up with the text
+        // inside of the edited regions
+        self.text.get(node.byte_range()).unwrap_or_default()
     }
+
+    /// Return the interned name for the text of `node`.
+    pub fn node_id(&self, node: &ts::Node) -> Id {
+        Id::new(self.node_text(node))
+    }
+}
+
+/// A parse of a snapshot of a document's text, which runs without holding
+/// the document's lock so that the current tree keeps serving queries.
+pub struct ParseJob {
+    /// the version of the document that `text` was taken from
+    version: u64,
+    text: Arc<String>,
+    /// the document's tree, with every edit since it was parsed applied
+    old_tree: Option<ts::Tree>,
+    /// set when a newer parse job makes this one stale
+    cancel: Arc<AtomicUsize>,
+    budget: Duration,
+}
+
+/// The result of a `ParseJob`
+pub struct Parsed {
+    version: u64,
+    /// `None` if the parse ran out of time or was cancelled
+    tree: Option<ts::Tree>,
+}
+
+impl ParseJob {
+    /// Parse the text. This can take a long time for large files, so it
+    /// should run on a blocking thread.
+    pub fn run(self) -> Parsed {
+        let mut parser = parsers::checkout();
+        parser.set_timeout_micros(self.budget.as_micros() as u64);
+        // SAFETY: the flag is cleared when `parser` goes back into the pool,
+        // which happens before `self.cancel` is dropped
+        unsafe { parser.set_cancellation_flag(Some(&self.cancel)) };
+        let start = Instant::now();
+        let tree = parser.parse(self.text.as_bytes(), self.old_tree.as_ref());
+        stats::parsed(self.text.len(), start);
+        drop(parser);
+        Parsed {
+            version: self.version,
+            tree,
+        }
+    }
+}
+
+/// Return the first identifier directly under `node`, which is the name of
+/// a component or primitive.
+fn first_ident(node: ts::Node) -> Option<ts::Node> {
+    node.named_children(&mut node.walk())
+        .find(|n| n.kind_id() == node_kind::IDENT)
 }
@@ -0,0 +1,437 @@
+//! On-disk cache of the symbol index, so that a restarted server doesn't
+//! have to reparse every file of the workspace and the standard library.
+//!
+//! For every indexed file, the cache records what the index needs of it: the
+//! symbols that it defines and the imports that it names. An entry is only used
+//! if the file still hashes to what it hashed to when it was parsed, and the
+//! whole cache is thrown away if it was written by a server that was built
+//! from a different grammar.
+//!
+//! The cache is one file of little-endian binary data: a header, a table of
+//! every string in the cache, then the entries, which refer to strings by
+//! their index in the table.
+//!
+//! ```text
+//! header  = "CALYXIDX" version:u32 grammar:str
+//! strings = count:u32 str*
+//! entries = count:u32 entry*
+//! entry   = path:str hash:u64 imports:list count:u32 symbol*
+//! symbol  = name:u32 kind:u8 inputs:list outputs:list params:list
+//!           range:u32*4
+//! str     = len:u32 utf8-bytes
+//! list    = len:u32 u32*
+//! ```
+
+use std::collections::HashMap;
+use std::env;
+use std::fs;
+use std::io;
+use std::path::{Path, PathBuf};
+use std::process;
+use std::sync::Arc;
+
+use calyx_utils::Id;
+use tower_lsp::lsp_types as lspt;
+
+use crate::document::ComponentSig;
+use crate::log;
+use crate::symbols::{FileSymbols, Symbol, SymbolKind};
+
+const MAGIC: &[u8; 8] = b"CALYXIDX";
+
+/// Bump this whenever the layout of the cache changes.
+const FORMAT_VERSION: u32 = 1;
+
+/// Hash of the `parser.c` that this server was built from
+const GRAMMAR_FINGERPRINT: &str = env!("CALYX_GRAMMAR_FINGERPRINT");
+
+/// The cached index data of one file
+pub struct CachedFile {
+    /// hash of the text that this was extracted from
+    pub hash: u64,
+    pub symbols: FileSymbols,
+    /// the imports of the file, as written
+    pub imports: Vec<String>,
+}
+
+#[derive(Default)]
+pub struct IndexCache {
+    files: HashMap<PathBuf, CachedFile>,
+    /// whether there are entries that haven't been saved yet
+    dirty: bool,
+}
+
+/// FNV-1a hash of `bytes`
+pub fn hash(bytes: &[u8]) -> u64 {
+    bytes.iter().fold(0xcbf29ce484222325, |h, &b| {
+        (h ^ b as u64).wrapping_mul(0x100000001b3)
+    })
+}
+
+/// Where the cache is kept: `$XDG_CACHE_HOME/calyx-lsp/index.bin`, falling
+/// back to `~/.cache` if that isn't set.
+fn cache_path() -> Option<PathBuf> {
+    let dir = env::var_os("XDG_CACHE_HOME")
+        .filter(|dir| !dir.is_empty())
+        .map(PathBuf::from)
+        .or_else(|| {
+            env::var_os("HOME").map(|home| PathBuf::from(home).join(".cache"))
+        })?;
+    Some(dir.join("calyx-lsp").join("index.bin"))
+}
+
+impl IndexCache {
+    /// Load the cache from disk. The cache is empty if there isn't one yet, if
+    /// it can't be read, or if it was written for a different grammar.
+    pub fn load() -> Self {
+        let Some(path) = cache_path() else {
+            return Self::default();
+        };
+        let Ok(bytes) = fs::read(&path) else {
+            return Self::default();
+        };
+        match decode(&bytes) {
+            Some(files) => {
+                log::debug!(
+                    "loaded {} cached files from {}",
+                    files.len(),
+                    path.display()
+                );
+                Self {
+                    files,
+                    dirty: false,
+                }
+            }
+            None => {
+                log::debug!("ignoring stale index cache {}", path.display());
+                Self::default()
+            }
+        }
+    }
+
+    /// Return the entry for the file at `path`, if its text still hashes to
+    /// `hash`.
+    pub fn get(&self, path: &Path, hash: u64) -> Option<&CachedFile> {
+        self.files.get(path).filter(|file| file.hash == hash)
+    }
+
+    pub fn insert(&mut self, path: PathBuf, file: CachedFile) {
+        self.files.insert(path, file);
+        self.dirty = true;
+    }
+
+    /// Write the cache back to disk, if anything was added to it. Entries for
+    /// files that no longer exist are left out.
+    pub fn save(&mut self) -> io::Result<()> {
+        if !self.dirty {
+            return Ok(());
+        }
+        let Some(path) = cache_path() else {
+            return Ok(());
+        };
+        self.files.retain(|path, _| path.exists());
+        let bytes = encode(&self.files);
+
+        // servers for other workspaces may be writing the cache at the same
+        // time, so write to a private file and then move it into place
+        fs::create_dir_all(path.parent().unwrap())?;
+        let tmp = path.with_extension(format!("{}.tmp", process::id()));
+        fs::write(&tmp, bytes)?;
+        fs::rename(&tmp, &path)?;
+        self.dirty = false;
+        Ok(())
+    }
+}
+
+/// Interns the strings of the cache into its string table.
+#[derive(Default)]
+struct Strings {
+    table: Vec<String>,
+    indices: HashMap<String, u32>,
+}
+
+impl Strings {
+    fn index(&mut self, s: &str) -> u32 {
+        if let Some(&idx) = self.indices.get(s) {
+            return idx;
+        }
+        let idx = self.table.len() as u32;
+        self.table.push(s.to_string());
+        self.indices.insert(s.to_string(), idx);
+        idx
+    }
+}
+
+#[derive(Default)]
+struct Writer(Vec<u8>);
+
+impl Writer {
+    fn u8(&mut self, v: u8) {
+        self.0.push(v);
+    }
+
+    fn u32(&mut self, v: u32) {
+        self.0.extend_from_slice(&v.to_le_bytes());
+    }
+
+    fn u64(&mut self, v: u64) {
+        self.0.extend_from_slice(&v.to_le_bytes());
+    }
+
+    fn str(&mut self, s: &str) {
+        self.u32(s.len() as u32);
+        self.0.extend_from_slice(s.as_bytes());
+    }
+
+    fn list(&mut self, items: Vec<u32>) {
+        self.u32(items.len() as u32);
+        items.into_iter().for_each(|item| self.u32(item));
+    }
+}
+
+fn encode(files: &HashMap<PathBuf, CachedFile>) -> Vec<u8> {
+    // the entries are written first, so that the string table is complete
+    // by the time that it is written
+    let mut strings = Strings::default();
+    let mut entries = Writer::default();
+    let files = files
+        .iter()
+        .filter_map(|(path, file)| Some((path.to_str()?, file)))
+        .collect::<Vec<_>>();
+    entries.u32(files.len() as u32);
+    for (path, file) in files {
+        entries.str(path);
+        entries.u64(file.hash);
+        entries.list(file.imports.iter().map(|i| strings.index(i)).collect());
+        entries.u32(file.symbols.len() as u32);
+        for (name, symbol) in file.symbols.iter() {
+            entries.u32(strings.index(name.as_ref()));
+            entries.u8(match symbol.kind {
+                SymbolKind::Component => 0,
+                SymbolKind::Primitive => 1,
+            });
+            let mut ids = |ids: &[Id]| {
+                ids.iter().map(|id| strings.index(id.as_ref())).collect()
+            };
+            entries.list(ids(&symbol.signature.inputs));
+            entries.list(ids(&symbol.signature.outputs));
+            entries.list(ids(&symbol.params));
+            let range = symbol.range;
+            for v in [
+                range.start.line,
+                range.start.character,
+                range.end.line,
+                range.end.character,
+            ] {
+                entries.u32(v);
+            }
+        }
+    }
+
+    let mut out = Writer::default();
+    out.0.extend_from_slice(MAGIC);
+    out.u32(FORMAT_VERSION);
+    out.str(GRAMMAR_FINGERPRINT);
+    out.u32(strings.table.len() as u32);
+    for s in &strings.table {
+        out.str(s);
+    }
+    out.0.extend_from_slice(&entries.0);
+    out.0
+}
+
+struct Reader<'a> {
+    bytes: &'a [u8],
+}
+
+impl<'a> Reader<'a> {
+    fn take(&mut self, n: usize) -> Option<&'a [u8]> {
+        if n > self.bytes.len() {
+            return None;
+        }
+        let (taken, rest) = self.bytes.split_at(n);
+        self.bytes = rest;
+        Some(taken)
+    }
+
+    fn u8(&mut self) -> Option<u8> {
+        self.take(1).map(|b| b[0])
+    }
+
+    fn u32(&mut self) -> Option<u32> {
+        self.take(4)
+            .map(|b| u32::from_le_bytes(b.try_into().unwrap()))
+    }
+
+    fn u64(&mut self) -> Option<u64> {
+        self.take(8)
+            .map(|b| u64::from_le_bytes(b.try_into().unwrap()))
+    }
+
+    fn str(&mut self) -> Option<&'a str> {
+        let len = self.u32()? as usize;
+        std::str::from_utf8(self.take(len)?).ok()
+    }
+
+    /// Read a list of indices into `strings`.
+    fn list<T>(
+        &mut self,
+        strings: &[&str],
+        f: impl Fn(&str) -> T,
+    ) -> Option<Vec<T>> {
+        let len = self.u32()?;
+        (0..len)
+            .map(|_| strings.get(self.u32()? as usize).map(|s| f(s)))
+            .collect()
+    }
+}
+
+/// Decode a cache. Returns `None` if it is malformed, or was written by a
+/// server with a different format or grammar.
+fn decode(bytes: &[u8]) -> Option<HashMap<PathBuf, CachedFile>> {
+    let mut r = Reader { bytes };
+    if r.take(MAGIC.len())? != MAGIC
+        || r.u32()? != FORMAT_VERSION
+        || r.str()? != GRAMMAR_FINGERPRINT
+    {
+        return None;
+    }
+    let strings = (0..r.u32()?).map(|_| r.str()).collect::<Option<Vec<_>>>()?;
+
+    let mut files = HashMap::new();
+    for _ in 0..r.u32()? {
+        let path = PathBuf::from(r.str()?);
+        let hash = r.u64()?;
+        let imports = r.list(&strings, str::to_string)?;
+        let mut symbols = HashMap::new();
+        for _ in 0..r.u32()? {
+            let name = Id::new(*strings.get(r.u32()? as usize)?);
+            let kind = match r.u8()? {
+                0 => SymbolKind::Component,
+                1 => SymbolKind::Primitive,
+                _ => return None,
+            };
+            let signature = Arc::new(ComponentSig {
+                inputs: r.list(&strings, |s| Id::new(s))?,
+                outputs: r.list(&strings, |s| Id::new(s))?,
+            });
+            let params = r.list(&strings, |s| Id::new(s))?;
+            let range = lspt::Range::new(
+                lspt::Position::new(r.u32()?, r.u32()?),
+                lspt::Position::new(r.u32()?, r.u32()?),
+            );
+            symbols.insert(
+                name,
+                Symbol {
+                    kind,
+                    signature,
+                    params,
+                    range,
+                },
+            );
+        }
+        files.insert(
+            path,
+            CachedFile {
+                hash,
+                symbols: Arc::new(symbols),
+                imports,
+            },
+        );
+    }
+    Some(files)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn symbol(kind: SymbolKind, inputs: &[&str], line: u32) -> Symbol {
+        Symbol {
+            kind,
+            signature: Arc::new(ComponentSig {
+                inputs: inputs.iter().map(|s| Id::new(s)).collect(),
+                outputs: vec![Id::new("out"), Id::new("done")],
+            }),
+            params: match kind {
+                SymbolKind::Primitive => vec![Id::new("WIDTH")],
+                SymbolKind::Component => vec![],
+            },
+            range: lspt::Range::new(
+                lspt::Position::new(line, 10),
+                lspt::Position::new(line, 14),
+            ),
+        }
+    }
+
+    fn files() -> HashMap<PathBuf, CachedFile> {
+        let main = HashMap::from([
+            (
+                Id::new("main"),
+                symbol(SymbolKind::Component, &["in", "go"], 3),
+            ),
+            (Id::new("helper"), symbol(SymbolKind::Component, &[], 20)),
+        ]);
+        let core = HashMap::from([(
+            Id::new("std_reg"),
+            symbol(SymbolKind::Primitive, &["in", "write_en"], 7),
+        )]);
+        HashMap::from([
+            (
+                PathBuf::from("/work/main.futil"),
+                CachedFile {
+                    hash: hash(b"main"),
+                    symbols: Arc::new(main),
+                    imports: vec!["primitives/core.futil".to_string()],
+                },
+            ),
+            (
+                PathBuf::from("/lib/primitives/core.futil"),
+                CachedFile {
+                    hash: hash(b"core"),
+                    symbols: Arc::new(core),
+                    imports: vec![],
+                },
+            ),
+        ])
+    }
+
+    #[test]
+    fn roundtrip() {
+        let files = files();
+        let decoded = decode(&encode(&files)).unwrap();
+        assert_eq!(decoded.len(), files.len());
+        for (path, file) in &files {
+            let got = &decoded[path];
+            assert_eq!(got.hash, file.hash);
+            assert_eq!(got.imports, file.imports);
+            assert_eq!(got.symbols.len(), file.symbols.len());
+            for (name, symbol) in file.symbols.iter() {
+                let got = &got.symbols[name];
+                assert_eq!(got.kind, symbol.kind);
+                assert_eq!(got.signature.inputs, symbol.signature.inputs);
+                assert_eq!(got.signature.outputs, symbol.signature.outputs);
+                assert_eq!(got.params, symbol.params);
+                assert_eq!(got.range, symbol.range);
+            }
+        }
+    }
+
+    #[test]
+    fn truncated() {
+        let bytes = encode(&files());
+        for len in 0..bytes.len() {
+            assert!(decode(&bytes[..len]).is_none(), "decoded {len} bytes");
+        }
+    }
+
+    #[test]
+    fn other_grammar() {
+        let mut bytes = encode(&files());
+        // the fingerprint follows the magic, the version and its length
+        let start = MAGIC.len() + 4 + 4;
+        assert_eq!(&bytes[start..start + 16], GRAMMAR_FINGERPRINT.as_bytes());
+        bytes[start] = if bytes[start] == b'0' { b'1' } else { b'0' };
+        assert!(decode(&bytes).is_none());
+    }
+}
@@ -0,0 +1,323 @@
+//! Indexes the import closure of the workspace when the server starts.
+//!
+//! Without this, imports are only discovered the first time that a request
+//! needs them, so the first completion or goto-definition in a large project
+//! waits for the whole import chain to be read and parsed one file at a time.
+//! Instead, startup finds every `.futil` file under the workspace folders and
+//! indexes them, and everything they (transitively) import, in parallel on the
+//! blocking thread pool. Each file is added to the symbol index as soon as it
+//! is parsed, so requests can use it while the rest are still being parsed.
+//!
+//! Files that haven't changed since the last time that they were indexed are
+//! not parsed at all: their symbols and imports come from the on-disk
+//! `IndexCache`, which is brought up to date once indexing is done.
+//!
+//! Only imported files are kept in the library cache, since requests are
+//! going to need their documents. The other files under the workspace are
+//! parsed, and their documents dropped as soon as their symbols and imports
+//! have been extracted, so that memory doesn't grow with the workspace. A
+//! workspace file whose document was dropped before anything was found to
+//! import it is parsed again, into the library cache, once something does.
+
+use std::collections::{HashMap, HashSet, VecDeque};
+use std::fs;
+use std::path::{Path, PathBuf};
+use std::sync::{Arc, RwLock};
+use std::thread;
+
+use tokio::task::JoinSet;
+use tower_lsp::lsp_types as lspt;
+use tower_lsp::Client;
+
+use crate::document::{Document, SharedDocument};
+use crate::index_cache::{self, CachedFile, IndexCache};
+use crate::library;
+use crate::log;
+use crate::symbols::{FileSymbols, SymbolIndex};
+
+/// Directories that never hold Calyx sources worth indexing
+const IGNORED_DIRS: &[&str] = &["target", "node_modules"];
+
+/// A parsed file, ready to be added to the index
+struct ParsedFile {
+    path: PathBuf,
+    url: lspt::Url,
+    symbols: FileSymbols,
+    imports: Vec<PathBuf>,
+    /// the new cache entry for the file, if it wasn't in the cache
+    fresh: Option<CachedFile>,
+    /// whether the parsed document was kept in the library cache
+    kept: bool,
+}
+
+/// Index every `.futil` file under `roots` and everything that they import,
+/// with imports resolved against `lib_paths`. Files that are open in the
+/// editor are indexed from the editor's copy instead, so they are parsed but
+/// not added. Progress is reported to the client if `report_progress` is set.
+pub async fn index_workspace(
+    client: Client,
+    symbols: Arc<RwLock<SymbolIndex>>,
+    open_docs: Arc<RwLock<HashMap<lspt::Url, SharedDocument>>>,
+    roots: Vec<PathBuf>,
+    lib_paths: Vec<String>,
+    report_progress: bool,
+) {
+    let mut progress = match report_progress {
+        true => Progress::begin(client, "Indexing Calyx files").await,
+        false => None,
+    };
+    let (files, cache) = tokio::task::spawn_blocking(move || {
+        (futil_files(&roots), IndexCache::load())
+    })
+    .await
+    .unwrap_or_default();
+    let cache = Arc::new(RwLock::new(cache));
+    let mut seen: HashSet<PathBuf> = files.iter().cloned().collect();
+    // files that something imports, whether or not they are under a root
+    let mut imported: HashSet<PathBuf> = HashSet::new();
+    // files that were parsed without being kept in the library cache
+    let mut dropped: HashSet<PathBuf> = HashSet::new();
+    // files to index, or, if set, only to load into the library cache
+    let mut queue: VecDeque<(PathBuf, bool)> =
+        files.into_iter().map(|path| (path, false)).collect();
+    let lib_paths = Arc::new(lib_paths);
+    let slots = thread::available_parallelism().map_or(1, |n| n.get());
+    let mut running = JoinSet::new();
+    let mut done = 0;
+    let mut cached = 0;
+    loop {
+        while running.len() < slots {
+            let Some((path, load)) = queue.pop_front() else {
+                break;
+            };
+            if load {
+                running.spawn_blocking(move || {
+                    library::open(&path);
+                    None
+                });
+                continue;
+            }
+            let imported = imported.contains(&path);
+            let lib_paths = Arc::clone(&lib_paths);
+            let cache = Arc::clone(&cache);
+            running.spawn_blocking(move || {
+                Some(parse_file(&path, imported, &lib_paths, &cache))
+            });
+        }
+        let Some(result) = running.join_next().await else {
+            break;
+        };
+        let result = match result {
+            // a load into the library cache, which isn't counted
+            Ok(None) => continue,
+            Ok(Some(result)) => result,
+            Err(_) => None,
+        };
+        done += 1;
+        if let Some(file) = result {
+            match file.fresh {
+                Some(entry) => {
+                    // something may have imported it while it was parsed
+                    if !file.kept && imported.contains(&file.path) {
+                        queue.push_back((file.path.clone(), true));
+                    } else if !file.kept {
+                        dropped.insert(file.path.clone());
+                    }
+                    cache.write().unwrap().insert(file.path, entry)
+                }
+                None => cached += 1,
+            }
+            for import in &file.imports {
+                if !imported.insert(import.clone()) {
+                    continue;
+                }
+                if seen.insert(import.clone()) {
+                    queue.push_back((import.clone(), false));
+                } else if dropped.remove(import) {
+                    queue.push_back((import.clone(), true));
+                }
+            }
+            let imports = file
+                .imports
+                .into_iter()
+                .filter_map(|import| lspt::Url::from_file_path(import).ok())
+                .collect();
+            if !open_docs.read().unwrap().contains_key(&file.url) {
+                symbols.write().unwrap().update(
+                    file.url,
+                    file.symbols,
+                    imports,
+                );
+            }
+        }
+        if let Some(progress) = progress.as_mut() {
+            progress.report(done, seen.len()).await;
+        }
+    }
+
+    log::info!("indexed {done} files at startup, {cached} from the cache");
+    let saved =
+        tokio::task::spawn_blocking(move || cache.write().unwrap().save())
+            .await;
+    if let Ok(Err(e)) = saved {
+        log::info!("couldn't save the index cache: {e}");
+    }
+    if let Some(progress) = progress {
+        progress.end(format!("Indexed {done} files")).await;
+    }
+}
+
+/// Index the file at `path` from `cache` if it hasn't changed, or else parse
+/// it, through the library cache if it is `imported`.
+fn parse_file(
+    path: &Path,
+    imported: bool,
+    lib_paths: &[String],
+    cache: &RwLock<IndexCache>,
+) -> Option<ParsedFile> {
+    // the file is read once, and that same buffer is hashed and parsed
+    let modified = fs::metadata(path).and_then(|m| m.modified()).ok()?;
+    let text = fs::read_to_string(path).ok()?;
+    let hash = index_cache::hash(text.as_bytes());
+    if let Some(entry) = cache.read().unwrap().get(path, hash) {
+        let cur_dir = path.parent()?;
+        return Some(ParsedFile {
+            path: path.to_path_buf(),
+            url: lspt::Url::from_file_path(path).ok()?,
+            symbols: Arc::clone(&entry.symbols),
+            imports: entry
+                .imports
+                .iter()
+                .flat_map(|import| {
+                    library::resolve_import(cur_dir, import, lib_paths)
+                })
+                .collect(),
+            fresh: None,
+            kept: false,
+        });
+    }
+
+    let doc = if imported {
+        library::insert(path, modified, text)?
+    } else {
+        let url = lspt::Url::from_file_path(path).ok()?;
+        Arc::new(Document::new_with_text(url, text))
+    };
+    Some(ParsedFile {
+        path: path.to_path_buf(),
+        url: doc.url.clone(),
+        symbols: Arc::clone(&doc.symbols),
+        imports: doc.resolved_imports(lib_paths).collect(),
+        fresh: Some(CachedFile {
+            hash,
+            symbols: Arc::clone(&doc.symbols),
+            imports: doc.raw_imports(),
+        }),
+        kept: imported,
+    })
+}
+
+/// Find every `.futil` file under `roots`, skipping hidden and ignored
+/// directories.
+fn futil_files(roots: &[PathBuf]) -> Vec<PathBuf> {
+    let mut files = vec![];
+    let mut dirs = roots.to_vec();
+    while let Some(dir) = dirs.pop() {
+        let Ok(entries) = fs::read_dir(&dir) else {
+            continue;
+        };
+        for entry in entries.flatten() {
+            let path = entry.path();
+            let name = entry.file_name();
+            let name = name.to_string_lossy();
+            match entry.file_type() {
+                Ok(ty) if ty.is_dir() => {
+                    if !name.starts_with('.')
+                        && !IGNORED_DIRS.contains(&name.as_ref())
+                    {
+                        dirs.push(path);
+                    }
+                }
+                Ok(ty) if ty.is_file() && name.ends_with(".futil") => {
+                    files.push(path)
+                }
+                _ => (),
+            }
+        }
+    }
+    files
+}
+
+/// A `$/progress` report that is shown by the client
+struct Progress {
+    client: Client,
+    token: lspt::ProgressToken,
+    /// the last percentage that was reported
+    percentage: u32,
+}
+
+impl Progress {
+    /// Ask the client to show a new progress report. Returns `None` if it
+    /// refuses.
+    async fn begin(client: Client, title: &str) -> Option<Self> {
+        let token = lspt::NumberOrString::String("calyx-lsp/index".to_string());
+        client
+            .send_request::<lspt::request::WorkDoneProgressCreate>(
+                lspt::WorkDoneProgressCreateParams {
+                    token: token.clone(),
+                },
+            )
+            .await
+            .ok()?;
+        let progress = Self {
+            client,
+            token,
+            percentage: 0,
+        };
+        progress
+            .send(lspt::WorkDoneProgress::Begin(lspt::WorkDoneProgressBegin {
+                title: title.to_string(),
+                cancellable: Some(false),
+                message: None,
+                percentage: Some(0),
+            }))
+            .await;
+        Some(progress)
+    }
+
+    /// Report that `done` out of `total` files have been indexed. Only
+    /// changes in the percentage are sent to the client.
+    async fn report(&mut self, done: usize, total: usize) {
+        let percentage = (done * 100 / total.max(1)) as u32;
+        if percentage == self.percentage {
+            return;
+        }
+        self.percentage = percentage;
+        self.send(lspt::WorkDoneProgress::Report(
+            lspt::WorkDoneProgressReport {
+                cancellable: Some(false),
+                message: Some(format!("{done}/{total}")),
+                percentage: Some(percentage),
+            },
+        ))
+        .await;
+    }
+
+    async fn end(self, message: String) {
+        self.send(lspt::WorkDoneProgress::End(lspt::WorkDoneProgressEnd {
+            message: Some(message),
+        }))
+        .await;
+    }
+
+    async fn send(&self, value: lspt::WorkDoneProgress) {
+        self.client
+            .send_notification::<lspt::notification::Progress>(
+                lspt::ProgressParams {
+                    token: self.token.clone(),
+                    value: lspt::ProgressParamsValue::WorkDone(value),
+                },
+            )
+            .await;
+    }
+}
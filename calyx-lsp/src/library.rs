@@ -0,0 +1,113 @@
+//! Process-wide cache of library files.
+//!
+//! Most documents import the same handful of library files (`core.futil`,
+//! `binary_operators.futil`, ...). Rather than reading and parsing them once
+//! per use, every library file is parsed once and the resulting document is
+//! shared by everyone that needs it until the file changes on disk. Import
+//! resolution, which has to probe the file system for every library path, is
+//! memoized as well.
+
+use std::collections::HashMap;
+use std::fs;
+use std::path::{Path, PathBuf};
+use std::sync::{Arc, OnceLock, RwLock};
+use std::time::SystemTime;
+
+use itertools::Itertools;
+use resolve_path::PathResolveExt;
+use tower_lsp::lsp_types as lspt;
+
+use crate::document::Document;
+use crate::log;
+
+/// A parsed library file
+struct LibraryFile {
+    /// modification time of the file when it was read
+    modified: SystemTime,
+    doc: Arc<Document>,
+}
+
+#[derive(Default)]
+struct Cache {
+    /// parsed library files, keyed by path
+    files: RwLock<HashMap<PathBuf, LibraryFile>>,
+    /// map from (importing directory, import) to the paths it resolves to
+    imports: RwLock<HashMap<(PathBuf, String), Vec<PathBuf>>>,
+}
+
+fn cache() -> &'static Cache {
+    static CACHE: OnceLock<Cache> = OnceLock::new();
+    CACHE.get_or_init(Cache::default)
+}
+
+/// Return the document for the library file at `path`. The file is only
+/// read and parsed if it isn't cached yet, or if it has been modified since
+/// it was cached.
+pub fn open(path: &Path) -> Option<Arc<Document>> {
+    let Ok(modified) = fs::metadata(path).and_then(|m| m.modified()) else {
+        invalidate(path);
+        return None;
+    };
+    if let Some(file) = cache().files.read().unwrap().get(path) {
+        if file.modified == modified {
+            return Some(Arc::clone(&file.doc));
+        }
+    }
+
+    insert(path, modified, fs::read_to_string(path).ok()?)
+}
+
+/// Parse `text`, the contents of the library file at `path` as of
+/// `modified`, and cache the resulting document. For callers that have
+/// already read the file.
+pub fn insert(
+    path: &Path,
+    modified: SystemTime,
+    text: String,
+) -> Option<Arc<Document>> {
+    log::debug!("parsing library file {}", path.display());
+    let url = lspt::Url::from_file_path(path).ok()?;
+    // the document keeps this buffer, rather than a copy of it
+    let doc = Arc::new(Document::new_with_text(url, text));
+    cache().files.write().unwrap().insert(
+        path.to_path_buf(),
+        LibraryFile {
+            modified,
+            doc: Arc::clone(&doc),
+        },
+    );
+    Some(doc)
+}
+
+/// Resolve `import`, written in a file in `cur_dir`, against `cur_dir` and
+/// then each of `lib_paths`. Returns every candidate path that exists.
+pub fn resolve_import(
+    cur_dir: &Path,
+    import: &str,
+    lib_paths: &[String],
+) -> Vec<PathBuf> {
+    let key = (cur_dir.to_path_buf(), import.to_string());
+    if let Some(paths) = cache().imports.read().unwrap().get(&key) {
+        return paths.clone();
+    }
+
+    let paths = std::iter::once(cur_dir.to_path_buf())
+        .chain(lib_paths.iter().map(PathBuf::from))
+        .map(|lib_path| lib_path.join(import).resolve().into_owned())
+        .filter(|p| p.exists())
+        .collect_vec();
+    cache().imports.write().unwrap().insert(key, paths.clone());
+    paths
+}
+
+/// Forget the library file at `path`, and every import resolution, because
+/// the file has changed, been created, or been deleted.
+pub fn invalidate(path: &Path) {
+    cache().files.write().unwrap().remove(path);
+    invalidate_imports();
+}
+
+/// Forget every import resolution, e.g. because the library paths changed.
+pub fn invalidate_imports() {
+    cache().imports.write().unwrap().clear();
+}
@@ -0,0 +1,215 @@
+//! Conversions between byte offsets, tree-sitter points, and LSP positions.
+//!
+//! tree-sitter describes locations with byte offsets and (row, byte column)
+//! points, while LSP clients send and expect (line, UTF-16 column)
+//! positions. `LineIndex` records where every line of a document starts so
+//! that each conversion is a binary search followed, for LSP positions, by a
+//! scan of a single line.
+
+use tower_lsp::lsp_types as lspt;
+use tree_sitter as ts;
+
+/// Byte offsets of the start of every line in a document.
+#[derive(Debug)]
+pub struct LineIndex {
+    /// `starts[i]` is the offset of the first byte of line `i`. The first
+    /// line always starts at 0, so this is never empty.
+    starts: Vec<usize>,
+}
+
+impl Default for LineIndex {
+    fn default() -> Self {
+        Self { starts: vec![0] }
+    }
+}
+
+impl LineIndex {
+    /// Index the lines of `text`.
+    pub fn new(text: &str) -> Self {
+        Self {
+            starts: std::iter::once(0).chain(newlines(text, 0)).collect(),
+        }
+    }
+
+    /// Update the index after the bytes `start..old_end` of a document were
+    /// replaced with `new_text`.
+    pub fn edit(&mut self, start: usize, old_end: usize, new_text: &str) {
+        // lines that started inside of the replaced bytes are gone, and every
+        // newline in `new_text` starts a new one
+        let first = self.starts.partition_point(|&s| s <= start);
+        let last = self.starts.partition_point(|&s| s <= old_end);
+        self.starts.splice(first..last, newlines(new_text, start));
+        // lines after the edit just move over
+        let (removed, added) = (old_end - start, new_text.len());
+        let moved = first + new_text.matches('\n').count();
+        for line_start in &mut self.starts[moved..] {
+            *line_start = *line_start - removed + added;
+        }
+    }
+
+    /// Find the tree-sitter point for `byte`.
+    pub fn point(&self, byte: usize) -> ts::Point {
+        let row = self.starts.partition_point(|&s| s <= byte) - 1;
+        ts::Point {
+            row,
+            column: byte - self.starts[row],
+        }
+    }
+
+    /// Find the byte offset of the tree-sitter `point` in `text`. Like
+    /// `offset`, points past the end of a line, or of the document, are
+    /// clamped to that end.
+    pub fn byte(&self, text: &str, point: ts::Point) -> usize {
+        let Some(&line_start) = self.starts.get(point.row) else {
+            return text.len();
+        };
+        let line_end = self
+            .starts
+            .get(point.row + 1)
+            .map_or(text.len(), |next| next - 1);
+        floor_char_boundary(text, (line_start + point.column).min(line_end))
+    }
+
+    /// Translate `byte` in `text` into an LSP position. Offsets inside of a
+    /// multi-byte character are moved back to the start of that character.
+    pub fn position(&self, text: &str, byte: usize) -> lspt::Position {
+        let byte = floor_char_boundary(text, byte);
+        let point = self.point(byte);
+        let line = &text[self.starts[point.row]..byte];
+        lspt::Position::new(
+            point.row as u32,
+            line.encode_utf16().count() as u32,
+        )
+    }
+
+    /// Translate an LSP `position` in `text` into a byte offset. Positions
+    /// past the end of a line, or of the document, are clamped to that end.
+    pub fn offset(&self, text: &str, position: lspt::Position) -> usize {
+        let Some(&line_start) = self.starts.get(position.line as usize) else {
+            return text.len();
+        };
+        let line_end = self
+            .starts
+            .get(position.line as usize + 1)
+            .map_or(text.len(), |next| next - 1);
+        let mut utf16_column = 0;
+        text[line_start..line_end]
+            .char_indices()
+            .find(|(_, c)| {
+                utf16_column += c.len_utf16();
+                utf16_column > position.character as usize
+            })
+            .map_or(line_end, |(idx, _)| line_start + idx)
+    }
+}
+
+/// Offsets of the bytes following every newline in `text`, shifted by
+/// `base`.
+fn newlines(text: &str, base: usize) -> impl Iterator<Item = usize> + '_ {
+    text.bytes()
+        .enumerate()
+        .filter(|&(_, b)| b == b'\n')
+        .map(move |(idx, _)| base + idx + 1)
+}
+
+/// The largest character boundary in `text` that is at most `byte`.
+fn floor_char_boundary(text: &str, byte: usize) -> usize {
+    let mut byte = byte.min(text.len());
+    while !text.is_char_boundary(byte) {
+        byte -= 1;
+    }
+    byte
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    // `é` is two bytes and one UTF-16 unit, `𝄞` four bytes and two units
+    const TEXT: &str = "é𝄞x\nab\n\nlast";
+
+    fn point(row: usize, column: usize) -> ts::Point {
+        ts::Point { row, column }
+    }
+
+    #[test]
+    fn lines() {
+        assert_eq!(LineIndex::new(TEXT).starts, [0, 8, 11, 12]);
+        assert_eq!(LineIndex::new("").starts, [0]);
+        assert_eq!(LineIndex::new("\n").starts, [0, 1]);
+    }
+
+    #[test]
+    fn points() {
+        let index = LineIndex::new(TEXT);
+        assert_eq!(index.point(0), point(0, 0));
+        assert_eq!(index.point(6), point(0, 6));
+        assert_eq!(index.point(7), point(0, 7));
+        assert_eq!(index.point(8), point(1, 0));
+        assert_eq!(index.point(11), point(2, 0));
+        assert_eq!(index.point(12), point(3, 0));
+        assert_eq!(index.point(TEXT.len()), point(3, 4));
+
+        assert_eq!(index.byte(TEXT, point(0, 6)), 6);
+        assert_eq!(index.byte(TEXT, point(1, 1)), 9);
+        // inside of `𝄞`, past the end of a line and past the last line
+        assert_eq!(index.byte(TEXT, point(0, 4)), 2);
+        assert_eq!(index.byte(TEXT, point(1, 9)), 10);
+        assert_eq!(index.byte(TEXT, point(9, 0)), TEXT.len());
+    }
+
+    #[test]
+    fn utf16_positions() {
+        let index = LineIndex::new(TEXT);
+        let position = |byte| index.position(TEXT, byte);
+        assert_eq!(position(0), lspt::Position::new(0, 0));
+        assert_eq!(position(2), lspt::Position::new(0, 1));
+        assert_eq!(position(6), lspt::Position::new(0, 3));
+        assert_eq!(position(7), lspt::Position::new(0, 4));
+        assert_eq!(position(9), lspt::Position::new(1, 1));
+        assert_eq!(position(TEXT.len()), lspt::Position::new(3, 4));
+        // bytes inside of a character belong to that character
+        assert_eq!(position(1), lspt::Position::new(0, 0));
+        assert_eq!(position(4), lspt::Position::new(0, 1));
+
+        let offset = |line, character| {
+            index.offset(TEXT, lspt::Position::new(line, character))
+        };
+        assert_eq!(offset(0, 0), 0);
+        assert_eq!(offset(0, 1), 2);
+        assert_eq!(offset(0, 3), 6);
+        assert_eq!(offset(1, 2), 10);
+        // in the middle of `𝄞`'s surrogate pair
+        assert_eq!(offset(0, 2), 2);
+        // past the end of a line, of the last line, and of the document
+        assert_eq!(offset(0, 9), 7);
+        assert_eq!(offset(2, 1), 11);
+        assert_eq!(offset(3, 9), TEXT.len());
+        assert_eq!(offset(9, 0), TEXT.len());
+
+        for byte in (0..=TEXT.len()).filter(|&b| TEXT.is_char_boundary(b)) {
+            assert_eq!(index.offset(TEXT, position(byte)), byte);
+        }
+    }
+
+    #[test]
+    fn edits() {
+        // (start, old end, new text) applied to TEXT
+        let edits = [
+            (0, 0, "\n"),
+            (7, 8, ""),
+            (6, 11, "y"),
+            (9, 9, "1\n2\n\n3"),
+            (0, TEXT.len(), ""),
+            (TEXT.len(), TEXT.len(), "\nmore\n"),
+            (2, 10, "é\né"),
+        ];
+        for (start, old_end, new_text) in edits {
+            let mut text = TEXT.to_string();
+            let mut index = LineIndex::new(&text);
+            text.replace_range(start..old_end, new_text);
+            index.edit(start, old_end, new_text);
+            assert_eq!(index.starts, LineIndex::new(&text).starts, "{text:?}");
+        }
+    }
+}
@@ -1,67 +1,194 @@
+//! Leveled debug logging for the language server.
+//!
+//! Messages are built lazily: a message is only formatted when the `log`
+//! feature is enabled and its level passes the maximum level, which is read
+//! from the `CALYX_LSP_LOG` environment variable (`error`, `warn`, `info`,
+//! `debug` or `trace`; defaults to `info`). Formatted messages are handed to a
+//! background thread that owns a single buffered handle to
+//! `/tmp/calyx-lsp-debug.log`, so logging never blocks on the file system.
+//! Without the `log` feature every logging call compiles to nothing.
+
 #[cfg(feature = "log")]
 use chrono::Local;
 #[cfg(feature = "log")]
-use std::fs::OpenOptions;
+use std::fs::{self, OpenOptions};
+#[cfg(feature = "log")]
+use std::io::{BufWriter, Write};
+#[cfg(feature = "log")]
+use std::sync::atomic::{AtomicU8, Ordering};
+#[cfg(feature = "log")]
+use std::sync::{mpsc, OnceLock};
+#[cfg(feature = "log")]
+use std::thread;
+
+#[allow(unused)]
+#[derive(Clone, Copy, Debug, PartialEq, Eq, PartialOrd, Ord)]
+pub enum Level {
+    Error,
+    Warn,
+    Info,
+    Debug,
+    Trace,
+}
+
 #[cfg(feature = "log")]
-use std::io::Write;
-
-pub struct Debug;
-
-impl Debug {
-    /// Write log message to `/tmp/calyx-lsp-debug.log`
-    #[allow(unused)]
-    pub fn stdout<S: AsRef<str>>(msg: S) {
-        #[cfg(feature = "log")]
-        {
-            let mut file = OpenOptions::new()
-                .create(true)
-                .append(true)
-                .open(format!("/tmp/calyx-lsp-debug.log"))
-                .unwrap();
-            writeln!(file, "{}", msg.as_ref()).expect("Unable to write file");
+impl Level {
+    fn from_env() -> Self {
+        match std::env::var("CALYX_LSP_LOG").as_deref() {
+            Ok("error") => Level::Error,
+            Ok("warn") => Level::Warn,
+            Ok("debug") => Level::Debug,
+            Ok("trace") => Level::Trace,
+            _ => Level::Info,
         }
     }
 
-    /// Initialize the `/tmp/calyx-lsp-debug.log` file.
-    /// Create the file if it doesn't exist. Truncate the file
-    /// if it does exist.
-    #[allow(unused)]
-    pub fn init<S: AsRef<str>>(msg: S) {
-        #[cfg(feature = "log")]
-        {
-            let mut file = OpenOptions::new()
-                .create(true)
-                .write(true)
-                .truncate(true)
-                .open(format!("/tmp/calyx-lsp-debug.log"))
-                .unwrap();
-            writeln!(file, "{} {}", msg.as_ref(), Local::now().to_rfc2822())
-                .expect("Unable to write file");
+    fn label(self) -> &'static str {
+        match self {
+            Level::Error => "ERROR",
+            Level::Warn => "WARN",
+            Level::Info => "INFO",
+            Level::Debug => "DEBUG",
+            Level::Trace => "TRACE",
         }
     }
+}
+
+/// Work for the background writer.
+#[cfg(feature = "log")]
+enum Message {
+    /// Append a line to `/tmp/calyx-lsp-debug.log`.
+    Line(String),
+    /// Replace the contents of `/tmp/calyx-lsp-debug-{name}.log`.
+    Snapshot { name: String, contents: String },
+}
+
+/// The most verbose level that is currently logged.
+#[cfg(feature = "log")]
+static MAX_LEVEL: AtomicU8 = AtomicU8::new(Level::Info as u8);
+
+/// Channel to the background writer. The writer is started, and the log
+/// file truncated, the first time that this is used.
+#[cfg(feature = "log")]
+fn sender() -> &'static mpsc::Sender<Message> {
+    static SENDER: OnceLock<mpsc::Sender<Message>> = OnceLock::new();
+    SENDER.get_or_init(|| {
+        let (tx, rx) = mpsc::channel();
+        thread::Builder::new()
+            .name("calyx-lsp-log".to_string())
+            .spawn(move || writer(rx))
+            .expect("Unable to start log writer");
+        tx
+    })
+}
 
-    /// Write some `msg` to a debug log file called `/tmp/calyx-lsp-debug-{name}.log`.
-    /// This method truncates the file before writing. This is useful to recording the
-    /// current state of something.
-    #[allow(unused)]
-    pub fn update<S: AsRef<str>>(name: &str, msg: S) {
-        #[cfg(feature = "log")]
-        {
-            let mut file = OpenOptions::new()
-                .create(true)
-                .write(true)
-                .truncate(true)
-                .open(format!("/tmp/calyx-lsp-debug-{name}.log"))
-                .unwrap();
-            writeln!(file, "{}", msg.as_ref()).expect("Unable to write file");
+/// Drain `rx` into the log files, flushing whenever we catch up.
+#[cfg(feature = "log")]
+fn writer(rx: mpsc::Receiver<Message>) {
+    let Ok(file) = OpenOptions::new()
+        .create(true)
+        .write(true)
+        .truncate(true)
+        .open("/tmp/calyx-lsp-debug.log")
+    else {
+        return;
+    };
+    let mut file = BufWriter::new(file);
+    while let Ok(msg) = rx.recv() {
+        for msg in std::iter::once(msg).chain(rx.try_iter()) {
+            match msg {
+                Message::Line(line) => {
+                    let _ = writeln!(file, "{line}");
+                }
+                Message::Snapshot { name, contents } => {
+                    let _ = fs::write(
+                        format!("/tmp/calyx-lsp-debug-{name}.log"),
+                        contents,
+                    );
+                }
+            }
         }
+        let _ = file.flush();
     }
 }
 
-macro_rules! stdout {
+/// Return true if messages at `level` are currently being logged.
+#[inline]
+#[allow(unused)]
+pub fn enabled(level: Level) -> bool {
+    #[cfg(feature = "log")]
+    {
+        level as u8 <= MAX_LEVEL.load(Ordering::Relaxed)
+    }
+    #[cfg(not(feature = "log"))]
+    {
+        let _ = level;
+        false
+    }
+}
+
+/// Initialize logging: read the maximum level from the environment and
+/// start a fresh `/tmp/calyx-lsp-debug.log` with a `msg` header.
+#[allow(unused)]
+pub fn init<S: AsRef<str>>(msg: S) {
+    #[cfg(feature = "log")]
+    {
+        MAX_LEVEL.store(Level::from_env() as u8, Ordering::Relaxed);
+        let _ = sender().send(Message::Line(format!(
+            "{} {}",
+            msg.as_ref(),
+            Local::now().to_rfc2822()
+        )));
+    }
+}
+
+/// Log the message built by `msg` at `level`. `msg` is only called when
+/// `level` is enabled.
+#[inline]
+#[allow(unused)]
+pub fn write<F: FnOnce() -> String>(level: Level, msg: F) {
+    #[cfg(feature = "log")]
+    if enabled(level) {
+        let line = format!("[{}] {}", level.label(), msg());
+        let _ = sender().send(Message::Line(line));
+    }
+}
+
+/// Replace the contents of `/tmp/calyx-lsp-debug-{name}.log` with the
+/// string built by `contents`. This is useful for recording the current
+/// state of something. `contents` is only called when `level` is enabled.
+#[inline]
+#[allow(unused)]
+pub fn update<F: FnOnce() -> String>(level: Level, name: &str, contents: F) {
+    #[cfg(feature = "log")]
+    if enabled(level) {
+        let _ = sender().send(Message::Snapshot {
+            name: name.to_string(),
+            contents: contents(),
+        });
+    }
+}
+
+#[allow(unused_macros)]
+macro_rules! info {
+    ($($t:tt)*) => {{
+        $crate::log::write($crate::log::Level::Info, || format!($($t)*))
+    }};
+}
+
+#[allow(unused_macros)]
+macro_rules! debug {
+    ($($t:tt)*) => {{
+        $crate::log::write($crate::log::Level::Debug, || format!($($t)*))
+    }};
+}
+
+#[allow(unused_macros)]
+macro_rules! trace {
     ($($t:tt)*) => {{
-        log::Debug::stdout(format!($($t)*))
+        $crate::log::write($crate::log::Level::Trace, || format!($($t)*))
     }};
 }
 
-pub(crate) use stdout;
+#[allow(unused)]
+pub(crate) use {debug, info, trace};
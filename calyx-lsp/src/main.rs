@@ -3,27 +3,33 @@ mod convert;
 mod diagnostic;
 mod document;
 mod goto_definition;
+mod index_cache;
+mod indexer;
+mod library;
+mod line_index;
 mod log;
-mod query_result;
+mod node_kind;
+mod parsers;
+mod queries;
+mod stats;
+mod symbols;
 mod ts_utils;
 
 use std::collections::HashMap;
-use std::fs;
 use std::path::PathBuf;
-use std::sync::RwLock;
+use std::sync::{Arc, Mutex, RwLock};
+use std::time::{Duration, Instant};
 
-use convert::{Point, Range};
-use diagnostic::Diagnostic;
-use document::Document;
+use diagnostic::DiagnosticsWorker;
+use document::{Document, ParseJob, SharedDocument};
 use goto_definition::DefinitionProvider;
-use query_result::QueryResult;
 use serde::Deserialize;
+use symbols::{FileSymbols, SymbolIndex};
 use tower_lsp::lsp_types::{self as lspt, Url};
 use tower_lsp::{jsonrpc, Client, LanguageServer, LspService, Server};
 use tree_sitter as ts;
 
 use crate::completion::CompletionProvider;
-use crate::log::Debug;
 
 extern "C" {
     /// Bind the tree-sitter parser to something that we can use in Rust
@@ -40,12 +46,22 @@ struct Config {
 struct CalyxLspConfig {
     #[serde(rename = "libraryPaths")]
     library_paths: Vec<String>,
+    /// How long, in milliseconds, a reparse of an open document may take
+    /// before it is abandoned. `0` means no limit. The first parse of a
+    /// document is never limited.
+    #[serde(rename = "parseTimeout", default = "default_parse_timeout")]
+    parse_timeout: u64,
+}
+
+fn default_parse_timeout() -> u64 {
+    2000
 }
 
 impl Default for CalyxLspConfig {
     fn default() -> Self {
         Self {
             library_paths: vec!["~/.calyx".to_string()],
+            parse_timeout: default_parse_timeout(),
         }
     }
 }
@@ -55,125 +71,204 @@ struct Backend {
     /// Connection to the client that is used for sending data
     client: Client,
     /// Currently open documents
-    open_docs: RwLock<HashMap<lspt::Url, document::Document>>,
+    open_docs: Arc<RwLock<HashMap<lspt::Url, SharedDocument>>>,
     /// Server configuration
     config: RwLock<Config>,
+    /// Computes and publishes diagnostics in the background
+    diagnostics: Arc<DiagnosticsWorker>,
+    /// Components and primitives defined by open documents and the library
+    /// files that they import
+    symbols: Arc<RwLock<SymbolIndex>>,
+    /// What `initialize` learned about the client that the indexing at
+    /// startup needs. Taken when indexing starts.
+    startup: Mutex<Option<Startup>>,
+}
+
+/// Information for indexing the workspace at startup
+struct Startup {
+    /// the workspace folders
+    roots: Vec<PathBuf>,
+    /// whether the client can show `$/progress` reports
+    progress: bool,
 }
 
 impl Backend {
     fn new(client: Client) -> Self {
+        let open_docs = Arc::new(RwLock::new(HashMap::default()));
         Self {
+            diagnostics: DiagnosticsWorker::new(
+                client.clone(),
+                Arc::clone(&open_docs),
+            ),
             client,
-            open_docs: RwLock::new(HashMap::default()),
+            open_docs,
             config: RwLock::new(Config::default()),
+            symbols: Arc::new(RwLock::new(SymbolIndex::default())),
+            startup: Mutex::new(None),
+        }
+    }
+
+    /// Open a new document located at `url` with contents `text`. The
+    /// document is parsed on the blocking thread pool.
+    async fn open(&self, url: lspt::Url, text: String) {
+        let mut doc = Document::new(url.clone());
+        doc.set_text(text);
+        let job = doc.start_parse(self.parse_budget());
+        {
+            let start = Instant::now();
+            let mut open_docs = self.open_docs.write().unwrap();
+            stats::lock_wait("openDocs", start);
+            open_docs
+                .insert(url.clone(), Arc::new(tokio::sync::RwLock::new(doc)));
         }
+        self.parse(&url, job).await;
     }
 
-    /// Open a new document located at `url` with contents `text`.
-    fn open(&self, url: lspt::Url, text: String) {
-        let mut map = self.open_docs.write().unwrap();
-        map.insert(url.clone(), Document::new_with_text(url, &text));
+    /// How long a parse of an open document may take.
+    fn parse_budget(&self) -> Duration {
+        Duration::from_millis(
+            self.config.read().unwrap().calyx_lsp.parse_timeout,
+        )
     }
 
-    /// Open a new document located at `url` with contents read
-    /// from that path on the system.
-    fn open_path(&self, url: lspt::Url) {
-        if let Ok(text) = fs::read_to_string(url.to_file_path().unwrap()) {
-            self.open(url.clone(), text)
+    /// Run `job` on the blocking thread pool, and then install its result
+    /// in the document at `url`. The document isn't locked while the job
+    /// runs, so requests keep being answered from the previous tree.
+    async fn parse(&self, url: &lspt::Url, job: ParseJob) {
+        let Ok(parsed) = tokio::task::spawn_blocking(move || job.run()).await
+        else {
+            return;
+        };
+        if let Some(doc) = self.document(url) {
+            let start = Instant::now();
+            let mut doc = doc.write().await;
+            stats::lock_wait("document", start);
+            doc.finish_parse(parsed);
         }
     }
 
-    /// Check if a path is currently opened.
-    fn exists(&self, url: &lspt::Url) -> bool {
-        let map = self.open_docs.read().unwrap();
-        map.contains_key(url)
+    /// Return the open document at `url`. The map is only locked for as
+    /// long as it takes to clone the handle.
+    fn document(&self, url: &lspt::Url) -> Option<SharedDocument> {
+        let start = Instant::now();
+        let open_docs = self.open_docs.read().unwrap();
+        stats::lock_wait("openDocs", start);
+        open_docs.get(url).cloned()
+    }
+
+    /// Wait for a read lock on `doc`.
+    async fn read_lock(
+        doc: &SharedDocument,
+    ) -> tokio::sync::RwLockReadGuard<'_, Document> {
+        let start = Instant::now();
+        let doc = doc.read().await;
+        stats::lock_wait("document", start);
+        doc
     }
 
     /// Read the contents of `url` using function `reader`.
-    fn read_document<F, T>(&self, url: &lspt::Url, reader: F) -> Option<T>
+    async fn read_document<F, T>(&self, url: &lspt::Url, reader: F) -> Option<T>
     where
-        F: FnMut(&Document) -> Option<T>,
+        F: FnOnce(&Document) -> Option<T>,
     {
-        self.open_docs
-            .read()
-            .ok()
-            .and_then(|map| map.get(url).and_then(reader))
+        let doc = self.document(url)?;
+        let doc = Self::read_lock(&doc).await;
+        reader(&doc)
     }
 
     /// Read the contents of `url` using function `reader`.
-    /// If the document isn't already open, then open it first.
-    fn read_and_open<F, T>(&self, url: &lspt::Url, reader: F) -> Option<T>
+    /// If the document isn't open in the editor, then read it from the
+    /// shared library cache instead.
+    async fn read_and_open<F, T>(&self, url: &lspt::Url, reader: F) -> Option<T>
     where
-        F: FnMut(&Document) -> Option<T>,
+        F: FnOnce(&Document) -> Option<T>,
     {
-        // if the file doesnt exist, read it's contents and create a doc for it
-        if !self.exists(url) {
-            self.open_path(url.clone());
+        if let Some(doc) = self.document(url) {
+            return reader(&*Self::read_lock(&doc).await);
         }
-
-        self.read_document(url, reader)
+        let path = url.to_file_path().ok()?;
+        let doc = tokio::task::spawn_blocking(move || library::open(&path))
+            .await
+            .ok()??;
+        reader(&doc)
     }
 
-    /// Update the document at `url` using function `updater`.
-    fn update<F>(&self, url: &lspt::Url, updater: F)
+    /// Update the document at `url` using function `updater`, which runs on
+    /// the blocking thread pool. Waiting for the document's lock is the
+    /// first thing that this does, and tokio's locks are fair, so updates are
+    /// applied in the order in which they were requested.
+    async fn update<F, T>(&self, url: &lspt::Url, updater: F) -> Option<T>
     where
-        F: FnMut(&mut Document),
+        F: FnOnce(&mut Document) -> T + Send + 'static,
+        T: Send + 'static,
     {
-        self.open_docs
-            .write()
+        let start = Instant::now();
+        let mut doc = self.document(url)?.write_owned().await;
+        stats::lock_wait("document", start);
+        tokio::task::spawn_blocking(move || updater(&mut doc))
+            .await
             .ok()
-            .map(|mut map| map.get_mut(url).map(updater));
     }
 
-    /// Publish diagnostics for document `url`.
-    async fn publish_diagnostics(&self, url: &lspt::Url) {
-        // TODO: factor the bulk of this method somewhere else
+    /// Return the symbols that `url` defines, and the files that it imports.
+    async fn file_symbols(
+        &self,
+        url: &lspt::Url,
+    ) -> Option<(FileSymbols, Vec<lspt::Url>)> {
+        self.read_and_open(url, |doc| {
+            let config = self.config.read().unwrap();
+            let imports = doc
+                .resolved_imports(&config.calyx_lsp.library_paths)
+                .filter_map(|path| lspt::Url::from_file_path(path).ok())
+                .collect();
+            Some((Arc::clone(&doc.symbols), imports))
+        })
+        .await
+    }
+
+    /// Bring the symbol index up to date with the document at `url`, and make
+    /// sure that every file it (transitively) imports is indexed as well.
+    async fn index(&self, url: &lspt::Url) {
+        let mut pending = vec![url.clone()];
+        while !pending.is_empty() {
+            for url in pending {
+                // files that can't be read are indexed as defining nothing,
+                // so that we don't keep trying to read them
+                let (symbols, imports) =
+                    self.file_symbols(&url).await.unwrap_or_default();
+                self.symbols.write().unwrap().update(url, symbols, imports);
+            }
+            pending = self.symbols.read().unwrap().missing(url);
+        }
+    }
+
+    /// Schedule diagnostics to be published for document `url`.
+    fn publish_diagnostics(&self, url: &lspt::Url) {
         let lib_path: PathBuf =
             self.config.read().unwrap().calyx_lsp.library_paths[0]
                 .to_string()
                 .into();
-        let diags = self
-            .read_document(url, |doc| {
-                Some(
-                    Diagnostic::did_save(
-                        &url.to_file_path().unwrap(),
-                        &lib_path,
-                    )
-                    .into_iter()
-                    .filter_map(|diag| {
-                        doc.byte_to_point(diag.pos_start).and_then(|s| {
-                            doc.byte_to_point(diag.pos_end)
-                                .map(|e| (Range::new(s, e), diag.msg))
-                        })
-                    })
-                    .map(|(range, message)| lspt::Diagnostic {
-                        range: range.into(),
-                        severity: Some(lspt::DiagnosticSeverity::ERROR),
-                        code: None,
-                        code_description: None,
-                        source: Some("calyx".to_string()),
-                        message,
-                        related_information: None,
-                        tags: None,
-                        data: None,
-                    })
-                    .inspect(|diag| log::stdout!("{diag:#?}"))
-                    .collect(),
-                )
-            })
-            .unwrap_or_default();
-        self.client
-            .publish_diagnostics(url.clone(), diags, None)
-            .await;
+        self.diagnostics.schedule(url.clone(), lib_path);
     }
 
-    /// Publish diagnostics for every open file.
-    async fn publish_all_diagnostics(&self) {
+    /// Schedule diagnostics to be published for every open file.
+    fn publish_all_diagnostics(&self) {
         let open_docs: Vec<_> =
             self.open_docs.read().unwrap().keys().cloned().collect();
         for x in open_docs {
-            self.publish_diagnostics(&x).await;
+            self.publish_diagnostics(&x);
+        }
+    }
+
+    /// Custom method: 'calyx/stats'
+    /// Returns the latency of each LSP method, the cost of parsing, the
+    /// number of queries run, and the time spent waiting on locks, since the
+    /// server started. Also writes out the trace, if tracing is enabled.
+    async fn stats(&self) -> jsonrpc::Result<serde_json::Value> {
+        if let Err(e) = stats::write_trace() {
+            log::info!("couldn't write the trace: {e}");
         }
+        Ok(stats::summary())
     }
 }
 
@@ -182,18 +277,34 @@ impl LanguageServer for Backend {
     /// LSP method: 'initialize'
     async fn initialize(
         &self,
-        _ip: lspt::InitializeParams,
+        ip: lspt::InitializeParams,
     ) -> jsonrpc::Result<lspt::InitializeResult> {
-        Debug::init("init");
+        log::init("init");
+        let roots = match ip.workspace_folders {
+            Some(folders) => folders.into_iter().map(|f| f.uri).collect(),
+            None => ip.root_uri.into_iter().collect::<Vec<_>>(),
+        };
+        *self.startup.lock().unwrap() = Some(Startup {
+            roots: roots
+                .into_iter()
+                .filter_map(|url| url.to_file_path().ok())
+                .collect(),
+            progress: ip
+                .capabilities
+                .window
+                .and_then(|w| w.work_done_progress)
+                .unwrap_or(false),
+        });
         Ok(lspt::InitializeResult {
             server_info: None,
             capabilities: lspt::ServerCapabilities {
-                // TODO: switch to incremental parsing
                 text_document_sync: Some(
                     lspt::TextDocumentSyncCapability::Options(
                         lspt::TextDocumentSyncOptions {
                             open_close: Some(true),
-                            change: Some(lspt::TextDocumentSyncKind::FULL),
+                            change: Some(
+                                lspt::TextDocumentSyncKind::INCREMENTAL,
+                            ),
                             will_save: None,
                             will_save_wait_until: None,
                             save: Some(
@@ -242,13 +353,48 @@ impl LanguageServer for Backend {
             let config: CalyxLspConfig =
                 serde_json::from_value(val[0].clone()).unwrap();
             self.config.write().unwrap().calyx_lsp = config;
+            library::invalidate_imports();
+        }
+
+        // watch library files so that we can drop stale copies of them
+        let watchers = lspt::DidChangeWatchedFilesRegistrationOptions {
+            watchers: vec![lspt::FileSystemWatcher {
+                glob_pattern: lspt::GlobPattern::String(
+                    "**/*.futil".to_string(),
+                ),
+                kind: None,
+            }],
+        };
+        let registration = lspt::Registration {
+            id: "calyx-lsp-watch-futil".to_string(),
+            method: "workspace/didChangeWatchedFiles".to_string(),
+            register_options: serde_json::to_value(watchers).ok(),
+        };
+        if let Err(err) =
+            self.client.register_capability(vec![registration]).await
+        {
+            log::info!("unable to watch library files: {err:?}");
+        }
+
+        // index the workspace in the background, now that we know where the
+        // libraries are
+        let startup = self.startup.lock().unwrap().take();
+        if let Some(startup) = startup {
+            tokio::spawn(indexer::index_workspace(
+                self.client.clone(),
+                Arc::clone(&self.symbols),
+                Arc::clone(&self.open_docs),
+                startup.roots,
+                self.config.read().unwrap().calyx_lsp.library_paths.clone(),
+                startup.progress,
+            ));
         }
 
         // force update of diagnostics because the configuration
         // can update the library-paths which might affect which
         // primitives are in scope, thus affecting diagnostics
         // TODO: does this do anything? have any documents been opened yet?
-        self.publish_all_diagnostics().await;
+        self.publish_all_diagnostics();
 
         self.client
             .log_message(lspt::MessageType::INFO, "server initialized!")
@@ -259,8 +405,11 @@ impl LanguageServer for Backend {
     /// Called when the client opens a new document. We get the entire
     /// text of the document.
     async fn did_open(&self, params: lspt::DidOpenTextDocumentParams) {
-        self.open(params.text_document.uri.clone(), params.text_document.text);
-        self.publish_diagnostics(&params.text_document.uri).await;
+        let _timer = stats::timer("textDocument/didOpen");
+        self.open(params.text_document.uri.clone(), params.text_document.text)
+            .await;
+        self.index(&params.text_document.uri).await;
+        self.publish_diagnostics(&params.text_document.uri);
     }
 
     /// LSP method: 'workspace/didChangeConfiguration'
@@ -272,27 +421,58 @@ impl LanguageServer for Backend {
         &self,
         params: lspt::DidChangeConfigurationParams,
     ) {
-        log::stdout!("document/didConfigurationChange");
+        log::info!("document/didConfigurationChange");
         let config: Config = serde_json::from_value(params.settings).unwrap();
         *self.config.write().unwrap() = config;
+        library::invalidate_imports();
 
         // force update of diagnostics because the configuration
         // can update the library-paths which might affect which
         // primitives are in scope, thus affecting diagnostics
-        self.publish_all_diagnostics().await;
+        self.publish_all_diagnostics();
+    }
+
+    /// LSP method: 'workspace/didChangeWatchedFiles'
+    /// Called when a watched `.futil` file was created, changed, or deleted
+    /// outside of the editor. Any cached copy of it is now stale.
+    async fn did_change_watched_files(
+        &self,
+        params: lspt::DidChangeWatchedFilesParams,
+    ) {
+        for event in params.changes {
+            if let Ok(path) = event.uri.to_file_path() {
+                library::invalidate(&path);
+            }
+            // open documents are indexed from the editor's copy
+            if !self.open_docs.read().unwrap().contains_key(&event.uri) {
+                self.symbols.write().unwrap().remove(&event.uri);
+            }
+        }
     }
 
     /// LSP method: 'textDocument/didChange'
     /// Called when the client updates a text document. Here we process all
     /// the text_update events in the order that they are defined in `params`.
-    /// Because we are using the `Full` sync-mode, this should be a single
-    /// event containing the entire updated source.
+    /// Because we are using the `Incremental` sync-mode, each event describes
+    /// a range of the document to replace and the tree is reparsed
+    /// incrementally once all of them have been applied. A newer change
+    /// cancels the reparse for an older one.
     async fn did_change(&self, params: lspt::DidChangeTextDocumentParams) {
-        self.update(&params.text_document.uri, |doc| {
-            for event in &params.content_changes {
-                doc.parse_whole_text(&event.text);
-            }
-        });
+        let _timer = stats::timer("textDocument/didChange");
+        let url = &params.text_document.uri;
+        let changes = params.content_changes;
+        let budget = self.parse_budget();
+        let Some(job) = self
+            .update(url, move |doc| {
+                doc.apply_changes(&changes);
+                doc.start_parse(budget)
+            })
+            .await
+        else {
+            return;
+        };
+        self.parse(url, job).await;
+        self.index(url).await;
     }
 
     /// LSP method: 'textDocument/didSave'
@@ -301,7 +481,7 @@ impl LanguageServer for Backend {
     #[cfg(feature = "diagnostics")]
     async fn did_save(&self, params: lspt::DidSaveTextDocumentParams) {
         let url = &params.text_document.uri;
-        self.publish_diagnostics(url).await;
+        self.publish_diagnostics(url);
     }
 
     /// LSP method: 'textDocument/definition'
@@ -310,21 +490,18 @@ impl LanguageServer for Backend {
         &self,
         params: lspt::GotoDefinitionParams,
     ) -> jsonrpc::Result<Option<lspt::GotoDefinitionResponse>> {
+        let _timer = stats::timer("textDocument/definition");
         let url = &params.text_document_position_params.text_document.uri;
-        let config = &self.config.read().unwrap();
+        self.index(url).await;
         Ok(self
             .read_document(url, |doc| {
-                doc.thing_at_point(
-                    params.text_document_position_params.position.into(),
-                )
-                .and_then(|thing| doc.find_thing(config, url.clone(), thing))
-            })
-            .and_then(|gdr| {
-                gdr.resolve(|gdr, path| {
-                    let url = lspt::Url::from_file_path(path).unwrap();
-                    self.read_and_open(&url, |doc| gdr.resume(config, doc))
-                })
+                let index = self.symbols.read().unwrap();
+                doc.thing_at_point(doc.point_from_lsp(
+                    params.text_document_position_params.position,
+                ))
+                .and_then(|thing| doc.find_thing(&index, thing))
             })
+            .await
             .map(lspt::GotoDefinitionResponse::Scalar))
     }
 
@@ -334,28 +511,18 @@ impl LanguageServer for Backend {
         &self,
         params: lspt::CompletionParams,
     ) -> jsonrpc::Result<Option<lspt::CompletionResponse>> {
+        let _timer = stats::timer("textDocument/completion");
         let url = &params.text_document_position.text_document.uri;
-        let point: Point = params.text_document_position.position.into();
+        let position = params.text_document_position.position;
         let trigger_char = params.context.and_then(|cc| cc.trigger_character);
-        let config = self.config.read().unwrap();
+        self.index(url).await;
         Ok(self
             .read_document(url, |doc| {
-                doc.complete(trigger_char.as_deref(), &point, &config)
-            })
-            .map(|reses| {
-                reses
-                    .into_iter()
-                    .filter_map(|res| {
-                        res.resolve(|res, path| {
-                            let url = lspt::Url::from_file_path(path).unwrap();
-                            self.read_and_open(&url, |doc| {
-                                res.resume(&config, doc)
-                            })
-                        })
-                    })
-                    .flatten()
-                    .collect::<Vec<_>>()
+                let index = self.symbols.read().unwrap();
+                let point = doc.point_from_lsp(position);
+                doc.complete(&index, trigger_char.as_deref(), &point)
             })
+            .await
             .map(|completions| {
                 lspt::CompletionResponse::Array(
                     completions.into_iter().map(|ci| ci.into()).collect(),
@@ -365,7 +532,10 @@ impl LanguageServer for Backend {
 
     /// LSP method: 'shutdown'
     async fn shutdown(&self) -> jsonrpc::Result<()> {
-        log::stdout!("shutdown");
+        log::info!("shutdown");
+        if let Err(e) = stats::write_trace() {
+            log::info!("couldn't write the trace: {e}");
+        }
         Ok(())
     }
 }
@@ -375,6 +545,9 @@ async fn main() {
     let stdin = tokio::io::stdin();
     let stdout = tokio::io::stdout();
 
-    let (service, socket) = LspService::new(Backend::new);
+    stats::init();
+    let (service, socket) = LspService::build(Backend::new)
+        .custom_method("calyx/stats", Backend::stats)
+        .finish();
     Server::new(stdin, stdout, socket).serve(service).await;
 }
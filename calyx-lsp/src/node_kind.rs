@@ -0,0 +1,11 @@
+//! The kind ids of the named nodes of the Calyx grammar.
+//!
+//! `Node::kind` looks the name of a node's kind up in the grammar's symbol
+//! table, so walking a tree and checking kinds by name compares a string on
+//! every hop. These constants are generated by `build.rs` from the symbol
+//! table in `parser.c`, so that walks compare `Node::kind_id`s instead, and
+//! they always agree with the grammar that is linked in.
+
+#![allow(dead_code)]
+
+include!(concat!(env!("OUT_DIR"), "/symbols.rs"));
@@ -0,0 +1,73 @@
+//! A process-wide pool of tree-sitter parsers.
+//!
+//! A parser only holds state while it is parsing, so rather than giving every
+//! document a parser of its own, parses check one out of this pool and return
+//! it when they are done. The pool never holds more parsers than there can be
+//! parses running at once on the blocking thread pool.
+
+use std::ops::{Deref, DerefMut};
+use std::sync::{Mutex, OnceLock};
+use std::thread;
+
+use tree_sitter as ts;
+
+use crate::tree_sitter_calyx;
+
+fn pool() -> &'static Mutex<Vec<ts::Parser>> {
+    static POOL: OnceLock<Mutex<Vec<ts::Parser>>> = OnceLock::new();
+    POOL.get_or_init(Mutex::default)
+}
+
+/// The most parsers that are kept for reuse
+fn capacity() -> usize {
+    static CAPACITY: OnceLock<usize> = OnceLock::new();
+    *CAPACITY
+        .get_or_init(|| thread::available_parallelism().map_or(1, |n| n.get()))
+}
+
+/// A parser checked out of the pool. It goes back into the pool when this is
+/// dropped.
+pub struct PooledParser(Option<ts::Parser>);
+
+/// Check a parser for Calyx out of the pool, creating one if the pool is
+/// empty.
+pub fn checkout() -> PooledParser {
+    let parser = pool().lock().unwrap().pop().unwrap_or_else(|| {
+        let mut parser = ts::Parser::new();
+        parser.set_language(unsafe { tree_sitter_calyx() }).unwrap();
+        parser
+    });
+    PooledParser(Some(parser))
+}
+
+impl Deref for PooledParser {
+    type Target = ts::Parser;
+
+    fn deref(&self) -> &Self::Target {
+        self.0.as_ref().unwrap()
+    }
+}
+
+impl DerefMut for PooledParser {
+    fn deref_mut(&mut self) -> &mut Self::Target {
+        self.0.as_mut().unwrap()
+    }
+}
+
+impl Drop for PooledParser {
+    fn drop(&mut self) {
+        let Some(mut parser) = self.0.take() else {
+            return;
+        };
+        // don't let the next user inherit the settings of this one, or the
+        // state of a parse that was halted half-way
+        parser.reset();
+        parser.set_timeout_micros(0);
+        // SAFETY: clearing the flag can't leave a dangling reference
+        unsafe { parser.set_cancellation_flag(None) };
+        let mut pool = pool().lock().unwrap();
+        if pool.len() < capacity() {
+            pool.push(parser);
+        }
+    }
+}
@@ -0,0 +1,98 @@
+//! Process-wide registry of compiled tree-sitter queries.
+//!
+//! Compiling a query against the Calyx grammar is much more expensive than
+//! running it, so every pattern is compiled the first time it is used and
+//! then shared by every document.
+
+use std::cell::RefCell;
+use std::collections::HashMap;
+use std::ops::Index;
+use std::sync::{Arc, OnceLock, RwLock};
+
+use tree_sitter as ts;
+
+use crate::tree_sitter_calyx;
+
+/// Map from query patterns to their compiled queries.
+type Registry = RwLock<HashMap<&'static str, Arc<ts::Query>>>;
+
+fn registry() -> &'static Registry {
+    static REGISTRY: OnceLock<Registry> = OnceLock::new();
+    REGISTRY.get_or_init(Registry::default)
+}
+
+thread_local! {
+    /// A query cursor owns its own match state, so keep one per thread
+    /// around instead of allocating a fresh one for every query we run.
+    static CURSOR: RefCell<ts::QueryCursor> =
+        RefCell::new(ts::QueryCursor::new());
+}
+
+/// Return the compiled query for `pattern`, compiling it if this is the
+/// first time that we have seen it.
+pub fn get(pattern: &'static str) -> Arc<ts::Query> {
+    if let Some(query) = registry().read().unwrap().get(pattern) {
+        return Arc::clone(query);
+    }
+    let mut map = registry().write().unwrap();
+    Arc::clone(map.entry(pattern).or_insert_with(|| {
+        let lang = unsafe { tree_sitter_calyx() };
+        Arc::new(
+            ts::Query::new(lang, pattern).unwrap_or_else(|err| {
+                panic!("Invalid Query:\n{}", err.message)
+            }),
+        )
+    }))
+}
+
+/// Run `pattern` on `node` and gather the captured nodes by capture.
+pub fn run<'tree>(
+    pattern: &'static str,
+    node: ts::Node<'tree>,
+    text: &[u8],
+) -> Captures<'tree> {
+    let query = get(pattern);
+    // every capture named in the pattern gets an entry, even if it matches
+    // nothing, so that it's always safe to index with a name from `pattern`
+    let mut nodes = vec![vec![]; query.capture_names().len()];
+    CURSOR.with(|cursor| {
+        let mut cursor = cursor.borrow_mut();
+        for qmatch in cursor.matches(&query, node, text) {
+            for capture in qmatch.captures {
+                nodes[capture.index as usize].push(capture.node);
+            }
+        }
+    });
+    Captures { query, nodes }
+}
+
+/// The result of running a query: the captured nodes for each capture
+/// name, in the order that they were matched.
+pub struct Captures<'tree> {
+    query: Arc<ts::Query>,
+    /// captured nodes, indexed by capture index
+    nodes: Vec<Vec<ts::Node<'tree>>>,
+}
+
+impl<'tree> Captures<'tree> {
+    fn capture_index(&self, name: &str) -> Option<usize> {
+        self.query.capture_names().iter().position(|n| n == name)
+    }
+
+    /// Take the nodes captured by `name` out of the result.
+    pub fn remove(&mut self, name: &str) -> Option<Vec<ts::Node<'tree>>> {
+        self.capture_index(name)
+            .map(|idx| std::mem::take(&mut self.nodes[idx]))
+    }
+}
+
+impl<'tree> Index<&str> for Captures<'tree> {
+    type Output = Vec<ts::Node<'tree>>;
+
+    fn index(&self, name: &str) -> &Self::Output {
+        let idx = self
+            .capture_index(name)
+            .unwrap_or_else(|| panic!("Query has no capture named @{name}"));
+        &self.nodes[idx]
+    }
+}
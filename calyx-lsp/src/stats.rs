@@ -0,0 +1,262 @@
+//! Process-wide instrumentation of where the server spends its time.
+//!
+//! Every LSP method records its latency into a histogram, parses record how
+//! long they took and how much text they covered, `Document::captures` counts
+//! the queries that it runs, and lock waits are recorded per lock. The
+//! `calyx/stats` request returns a summary of everything recorded so far.
+//!
+//! If `CALYX_LSP_TRACE` names a file, every timed span is also kept as an
+//! event in the Chrome trace format and written to that file on shutdown (and
+//! whenever `calyx/stats` is requested), so that it can be loaded into
+//! `chrome://tracing` or Perfetto.
+
+use std::cell::Cell;
+use std::collections::{BTreeMap, HashMap};
+use std::env;
+use std::fs;
+use std::io;
+use std::path::PathBuf;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::{Mutex, OnceLock};
+use std::time::{Duration, Instant};
+
+use itertools::Itertools;
+use serde_json::{json, Value};
+
+/// Latencies are bucketed by powers of two of microseconds, so the last
+/// bucket holds everything from about 18 minutes up.
+const BUCKETS: usize = 32;
+
+/// The most trace events that are kept
+const MAX_TRACE_EVENTS: usize = 1 << 20;
+
+/// A histogram of durations
+#[derive(Default)]
+struct Histogram {
+    /// bucket `i` counts durations of less than `2^i` microseconds that
+    /// aren't counted by an earlier bucket
+    buckets: [u64; BUCKETS],
+    count: u64,
+    total: Duration,
+    max: Duration,
+}
+
+impl Histogram {
+    fn record(&mut self, duration: Duration) {
+        let micros = duration.as_micros().min(u64::MAX as u128) as u64;
+        let bucket = (u64::BITS - micros.leading_zeros()) as usize;
+        self.buckets[bucket.min(BUCKETS - 1)] += 1;
+        self.count += 1;
+        self.total += duration;
+        self.max = self.max.max(duration);
+    }
+
+    /// An upper bound on the `q`th quantile, accurate to within a factor of
+    /// two.
+    fn quantile(&self, q: f64) -> Duration {
+        let rank = ((q * self.count as f64).ceil() as u64).max(1);
+        let mut seen = 0;
+        for (bucket, &count) in self.buckets.iter().enumerate() {
+            seen += count;
+            if seen >= rank {
+                return Duration::from_micros(1 << bucket).min(self.max);
+            }
+        }
+        self.max
+    }
+
+    fn summary(&self) -> Value {
+        let ms = |d: Duration| d.as_secs_f64() * 1000.0;
+        json!({
+            "count": self.count,
+            "meanMs": ms(self.total) / self.count.max(1) as f64,
+            "p50Ms": ms(self.quantile(0.5)),
+            "p90Ms": ms(self.quantile(0.9)),
+            "p99Ms": ms(self.quantile(0.99)),
+            "maxMs": ms(self.max),
+            "totalMs": ms(self.total),
+        })
+    }
+}
+
+/// A complete ("X") event of a Chrome trace
+struct TraceEvent {
+    name: &'static str,
+    /// microseconds since the server started
+    start: u64,
+    duration: u64,
+    thread: u64,
+}
+
+#[derive(Default)]
+struct Stats {
+    methods: BTreeMap<&'static str, Histogram>,
+    parses: Histogram,
+    parsed_bytes: u64,
+    /// time spent waiting for each lock
+    locks: BTreeMap<&'static str, Histogram>,
+    /// how often each query pattern has been run
+    queries: HashMap<&'static str, u64>,
+    trace: Vec<TraceEvent>,
+}
+
+fn stats() -> &'static Mutex<Stats> {
+    static STATS: OnceLock<Mutex<Stats>> = OnceLock::new();
+    STATS.get_or_init(Mutex::default)
+}
+
+/// When the server started, which is when this was first called
+fn epoch() -> Instant {
+    static EPOCH: OnceLock<Instant> = OnceLock::new();
+    *EPOCH.get_or_init(Instant::now)
+}
+
+/// The file that trace events are written to, if tracing is enabled
+fn trace_path() -> Option<&'static PathBuf> {
+    static TRACE: OnceLock<Option<PathBuf>> = OnceLock::new();
+    TRACE
+        .get_or_init(|| {
+            env::var_os("CALYX_LSP_TRACE")
+                .filter(|path| !path.is_empty())
+                .map(PathBuf::from)
+        })
+        .as_ref()
+}
+
+/// A small, stable id for the current thread, for trace events
+fn thread_id() -> u64 {
+    static NEXT: AtomicU64 = AtomicU64::new(1);
+    thread_local! {
+        static ID: Cell<u64> = Cell::new(0);
+    }
+    ID.with(|id| {
+        if id.get() == 0 {
+            id.set(NEXT.fetch_add(1, Ordering::Relaxed));
+        }
+        id.get()
+    })
+}
+
+/// Start the clock that trace events are measured against.
+pub fn init() {
+    epoch();
+}
+
+fn trace(stats: &mut Stats, name: &'static str, start: Instant, d: Duration) {
+    if trace_path().is_some() && stats.trace.len() < MAX_TRACE_EVENTS {
+        stats.trace.push(TraceEvent {
+            name,
+            start: start.saturating_duration_since(epoch()).as_micros() as u64,
+            duration: d.as_micros() as u64,
+            thread: thread_id(),
+        });
+    }
+}
+
+/// Times a span of work until it is dropped, and then records it as a call
+/// of `name`.
+pub struct Timer {
+    name: &'static str,
+    start: Instant,
+}
+
+/// Start timing a call of the method `name`.
+pub fn timer(name: &'static str) -> Timer {
+    Timer {
+        name,
+        start: Instant::now(),
+    }
+}
+
+impl Drop for Timer {
+    fn drop(&mut self) {
+        let elapsed = self.start.elapsed();
+        let mut stats = stats().lock().unwrap();
+        stats.methods.entry(self.name).or_default().record(elapsed);
+        trace(&mut stats, self.name, self.start, elapsed);
+    }
+}
+
+/// Record a parse of `bytes` bytes that started at `start`.
+pub fn parsed(bytes: usize, start: Instant) {
+    let elapsed = start.elapsed();
+    let mut stats = stats().lock().unwrap();
+    stats.parses.record(elapsed);
+    stats.parsed_bytes += bytes as u64;
+    trace(&mut stats, "parse", start, elapsed);
+}
+
+/// Record that the query `pattern` was run.
+pub fn query(pattern: &'static str) {
+    *stats().lock().unwrap().queries.entry(pattern).or_default() += 1;
+}
+
+/// Record that taking the lock `name` took since `start`.
+pub fn lock_wait(name: &'static str, start: Instant) {
+    let elapsed = start.elapsed();
+    stats()
+        .lock()
+        .unwrap()
+        .locks
+        .entry(name)
+        .or_default()
+        .record(elapsed);
+}
+
+/// A summary of everything recorded so far
+pub fn summary() -> Value {
+    let stats = stats().lock().unwrap();
+    let histograms = |map: &BTreeMap<&str, Histogram>| {
+        map.iter()
+            .map(|(name, h)| (name.to_string(), h.summary()))
+            .collect::<serde_json::Map<_, _>>()
+    };
+    // the patterns are long and mostly whitespace
+    let mut queries = stats
+        .queries
+        .iter()
+        .map(|(pattern, &n)| (pattern.split_whitespace().join(" "), n))
+        .collect::<Vec<_>>();
+    queries.sort_by(|a, b| b.1.cmp(&a.1));
+    json!({
+        "uptimeMs": epoch().elapsed().as_millis() as u64,
+        "methods": histograms(&stats.methods),
+        "parses": {
+            "time": stats.parses.summary(),
+            "bytes": stats.parsed_bytes,
+        },
+        "locks": histograms(&stats.locks),
+        "queries": {
+            "total": queries.iter().map(|(_, n)| n).sum::<u64>(),
+            "byPattern": queries
+                .into_iter()
+                .map(|(pattern, n)| json!({ "pattern": pattern, "count": n }))
+                .collect::<Vec<_>>(),
+        },
+    })
+}
+
+/// Write the trace events recorded so far to the `CALYX_LSP_TRACE` file, if
+/// tracing is enabled.
+pub fn write_trace() -> io::Result<()> {
+    let Some(path) = trace_path() else {
+        return Ok(());
+    };
+    let events = stats()
+        .lock()
+        .unwrap()
+        .trace
+        .iter()
+        .map(|event| {
+            json!({
+                "name": event.name,
+                "ph": "X",
+                "ts": event.start,
+                "dur": event.duration,
+                "pid": 1,
+                "tid": event.thread,
+            })
+        })
+        .collect::<Vec<_>>();
+    fs::write(path, json!({ "traceEvents": events }).to_string())
+}
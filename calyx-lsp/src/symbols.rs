@@ -0,0 +1,367 @@
+//! Workspace-wide index of the components and primitives that every indexed
+//! file defines.
+//!
+//! Each `Document` keeps the symbols it defines up to date as it is
+//! reparsed. The index records those symbols, together with the files that
+//! each file imports, for every open document and every library file that
+//! one of them imports. Finding a definition or completing a name is then a
+//! walk over the (few) files reachable from the requesting document rather
+//! than a walk over their syntax trees.
+
+use std::collections::{BTreeMap, HashMap, HashSet, VecDeque};
+use std::sync::Arc;
+
+use calyx_utils::Id;
+use tower_lsp::lsp_types as lspt;
+
+use crate::document::ComponentSig;
+
+/// What kind of definition a symbol is
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum SymbolKind {
+    Component,
+    Primitive,
+}
+
+/// A component or primitive defined at the top-level of a file
+#[derive(Clone, Debug)]
+pub struct Symbol {
+    pub kind: SymbolKind,
+    pub signature: Arc<ComponentSig>,
+    /// the parameters of a primitive
+    pub params: Vec<Id>,
+    /// the range of the name of this symbol
+    pub range: lspt::Range,
+}
+
+/// The symbols defined in a file
+pub type FileSymbols = Arc<HashMap<Id, Symbol>>;
+
+/// An indexed file
+struct IndexedFile {
+    symbols: FileSymbols,
+    /// the files that this file imports, in import order
+    imports: Vec<lspt::Url>,
+}
+
+#[derive(Default)]
+pub struct SymbolIndex {
+    files: HashMap<lspt::Url, IndexedFile>,
+    /// every symbol name defined by some indexed file
+    names: Trie,
+}
+
+impl SymbolIndex {
+    /// Record that `url` defines `symbols` and imports `imports`, replacing
+    /// whatever was recorded for it before.
+    pub fn update(
+        &mut self,
+        url: lspt::Url,
+        symbols: FileSymbols,
+        imports: Vec<lspt::Url>,
+    ) {
+        self.remove(&url);
+        for name in symbols.keys() {
+            self.names.insert(*name);
+        }
+        self.files.insert(url, IndexedFile { symbols, imports });
+    }
+
+    /// Forget everything that was recorded for `url`.
+    pub fn remove(&mut self, url: &lspt::Url) {
+        if let Some(old) = self.files.remove(url) {
+            for name in old.symbols.keys() {
+                self.names.remove(name.as_ref().as_bytes());
+            }
+        }
+    }
+
+    /// Return files that are reachable from `url` through imports, but that
+    /// haven't been indexed yet.
+    pub fn missing(&self, url: &lspt::Url) -> Vec<lspt::Url> {
+        let mut missing = vec![];
+        self.walk(url, |url, file| {
+            if file.is_none() {
+                missing.push(url.clone());
+            }
+        });
+        missing
+    }
+
+    /// Find the definition of `name` that is visible from `url`: either
+    /// in `url` itself or in one of its (transitive) imports.
+    pub fn find<'a>(
+        &'a self,
+        url: &'a lspt::Url,
+        name: &Id,
+    ) -> Option<(&'a lspt::Url, &'a Symbol)> {
+        self.reachable(url).into_iter().find_map(|(url, file)| {
+            file.symbols.get(name).map(|symbol| (url, symbol))
+        })
+    }
+
+    /// Return every symbol visible from `url` whose name starts with
+    /// `prefix`.
+    pub fn complete<'a>(
+        &'a self,
+        url: &'a lspt::Url,
+        prefix: &str,
+    ) -> Vec<(Id, &'a Symbol)> {
+        let files = self.reachable(url);
+        self.names
+            .with_prefix(prefix.as_bytes())
+            .into_iter()
+            .filter_map(|name| {
+                files
+                    .iter()
+                    .find_map(|(_, file)| file.symbols.get(&name))
+                    .map(|symbol| (name, symbol))
+            })
+            .collect()
+    }
+
+    /// Return the indexed files reachable from `url` in breadth-first order,
+    /// starting with `url` itself.
+    fn reachable<'a>(
+        &'a self,
+        url: &'a lspt::Url,
+    ) -> Vec<(&'a lspt::Url, &'a IndexedFile)> {
+        let mut files = vec![];
+        self.walk(url, |url, file| {
+            if let Some(file) = file {
+                files.push((url, file));
+            }
+        });
+        files
+    }
+
+    /// Visit `url` and every file it (transitively) imports once, in
+    /// breadth-first order. Files that aren't indexed are visited with
+    /// `None`.
+    fn walk<'a, F>(&'a self, url: &'a lspt::Url, mut visit: F)
+    where
+        F: FnMut(&'a lspt::Url, Option<&'a IndexedFile>),
+    {
+        let mut seen = HashSet::from([url]);
+        let mut queue = VecDeque::from([url]);
+        while let Some(url) = queue.pop_front() {
+            let file = self.files.get(url);
+            visit(url, file);
+            for import in file.iter().flat_map(|f| &f.imports) {
+                if seen.insert(import) {
+                    queue.push_back(import);
+                }
+            }
+        }
+    }
+}
+
+/// A byte-wise prefix tree of symbol names.
+#[derive(Default)]
+struct Trie {
+    children: BTreeMap<u8, Trie>,
+    /// the name that ends at this node, and the number of files that
+    /// define it
+    name: Option<(Id, usize)>,
+}
+
+impl Trie {
+    fn insert(&mut self, name: Id) {
+        let node = name
+            .as_ref()
+            .bytes()
+            .fold(self, |node, b| node.children.entry(b).or_default());
+        node.name.get_or_insert((name, 0)).1 += 1;
+    }
+
+    /// Remove one definition of the name spelled by `bytes`, pruning nodes
+    /// that no longer lead to a name.
+    fn remove(&mut self, bytes: &[u8]) {
+        match bytes.split_first() {
+            None => {
+                if let Some((_, count)) = &mut self.name {
+                    *count -= 1;
+                    if *count == 0 {
+                        self.name = None;
+                    }
+                }
+            }
+            Some((b, rest)) => {
+                if let Some(child) = self.children.get_mut(b) {
+                    child.remove(rest);
+                    if child.name.is_none() && child.children.is_empty() {
+                        self.children.remove(b);
+                    }
+                }
+            }
+        }
+    }
+
+    /// Return every name that starts with `prefix`, in sorted order.
+    fn with_prefix(&self, prefix: &[u8]) -> Vec<Id> {
+        let mut names = vec![];
+        let mut stack = prefix
+            .iter()
+            .try_fold(self, |node, b| node.children.get(b))
+            .into_iter()
+            .collect::<Vec<_>>();
+        while let Some(node) = stack.pop() {
+            names.extend(node.name.map(|(name, _)| name));
+            stack.extend(node.children.values().rev());
+        }
+        names
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn url(name: &str) -> lspt::Url {
+        lspt::Url::parse(&format!("file:///work/{name}.futil")).unwrap()
+    }
+
+    /// Symbols for components called `names`, each defined on its own line
+    fn symbols(names: &[&str]) -> FileSymbols {
+        let symbols = names.iter().enumerate().map(|(line, name)| {
+            let start = lspt::Position::new(line as u32, 10);
+            let symbol = Symbol {
+                kind: SymbolKind::Component,
+                signature: Arc::default(),
+                params: vec![],
+                range: lspt::Range::new(start, start),
+            };
+            (Id::new(name), symbol)
+        });
+        Arc::new(symbols.collect())
+    }
+
+    fn names(index: &SymbolIndex, url: &lspt::Url, prefix: &str) -> Vec<Id> {
+        index
+            .complete(url, prefix)
+            .into_iter()
+            .map(|(name, _)| name)
+            .collect()
+    }
+
+    #[test]
+    fn trie_with_prefix() {
+        let mut trie = Trie::default();
+        for name in ["add", "b", "a", "abc", "ab", "sub"] {
+            trie.insert(Id::new(name));
+        }
+        let a = ["a", "ab", "abc", "add"].map(Id::new);
+        assert_eq!(trie.with_prefix(b"a"), a);
+        assert_eq!(trie.with_prefix(b"ab"), ["ab", "abc"].map(Id::new));
+        assert_eq!(trie.with_prefix(b"abc"), [Id::new("abc")]);
+        assert!(trie.with_prefix(b"abcd").is_empty());
+        assert!(trie.with_prefix(b"z").is_empty());
+        let all = ["a", "ab", "abc", "add", "b", "sub"].map(Id::new);
+        assert_eq!(trie.with_prefix(b""), all);
+    }
+
+    #[test]
+    fn trie_remove() {
+        let mut trie = Trie::default();
+        trie.insert(Id::new("reg"));
+        trie.insert(Id::new("reg"));
+        trie.insert(Id::new("register"));
+
+        // `reg` is defined twice, so it stays until both are removed
+        trie.remove(b"reg");
+        assert_eq!(trie.with_prefix(b"re"), ["reg", "register"].map(Id::new));
+        trie.remove(b"reg");
+        assert_eq!(trie.with_prefix(b"re"), [Id::new("register")]);
+
+        // removing a name that isn't there changes nothing
+        trie.remove(b"regis");
+        trie.remove(b"x");
+        assert_eq!(trie.with_prefix(b""), [Id::new("register")]);
+
+        // and the last removal prunes every node
+        trie.remove(b"register");
+        assert!(trie.children.is_empty());
+    }
+
+    #[test]
+    fn name_in_two_files() {
+        let mut index = SymbolIndex::default();
+        let (main, a, b) = (url("main"), url("a"), url("b"));
+        index.update(
+            main.clone(),
+            symbols(&["main"]),
+            vec![a.clone(), b.clone()],
+        );
+        index.update(a.clone(), symbols(&["reg", "add"]), vec![]);
+        index.update(b.clone(), symbols(&["reg"]), vec![]);
+        assert_eq!(names(&index, &main, "re"), [Id::new("reg")]);
+
+        // updating a file replaces its names instead of counting them again
+        index.update(a.clone(), symbols(&["reg", "add"]), vec![]);
+        index.remove(&a);
+        assert_eq!(names(&index, &main, "re"), [Id::new("reg")]);
+        assert_eq!(index.find(&main, &Id::new("reg")).unwrap().0, &b);
+        assert!(index.find(&main, &Id::new("add")).is_none());
+
+        index.remove(&b);
+        assert!(names(&index, &main, "re").is_empty());
+        assert!(index.names.with_prefix(b"re").is_empty());
+    }
+
+    #[test]
+    fn find_prefers_nearer_imports() {
+        // main imports x and then y, and x imports deep
+        let mut index = SymbolIndex::default();
+        let (main, x, y, deep) = (url("main"), url("x"), url("y"), url("deep"));
+        index.update(
+            main.clone(),
+            symbols(&["main", "own"]),
+            vec![x.clone(), y.clone()],
+        );
+        index.update(x.clone(), symbols(&["first", "own"]), vec![deep.clone()]);
+        index.update(y.clone(), symbols(&["first", "near"]), vec![]);
+        index.update(deep.clone(), symbols(&["near", "far"]), vec![]);
+
+        let found = |name| index.find(&main, &Id::new(name)).unwrap().0;
+        // a file's own definitions come first, then its imports in import
+        // order, then their imports
+        assert_eq!(found("own"), &main);
+        assert_eq!(found("first"), &x);
+        assert_eq!(found("near"), &y);
+        assert_eq!(found("far"), &deep);
+        // imports are only followed forwards
+        assert!(index.find(&y, &Id::new("main")).is_none());
+
+        // completions are shadowed the same way
+        let complete: Vec<_> = index
+            .complete(&main, "")
+            .into_iter()
+            .map(|(name, symbol)| (name, symbol.range.start.line))
+            .collect();
+        let expected = [
+            ("far", 1),
+            ("first", 0),
+            ("main", 0),
+            ("near", 1),
+            ("own", 1),
+        ]
+        .map(|(name, line)| (Id::new(name), line));
+        assert_eq!(complete, expected);
+    }
+
+    #[test]
+    fn missing_imports() {
+        let mut index = SymbolIndex::default();
+        let (main, x, y) = (url("main"), url("x"), url("y"));
+        index.update(
+            main.clone(),
+            symbols(&["main"]),
+            vec![x.clone(), y.clone()],
+        );
+        index.update(x.clone(), symbols(&[]), vec![main.clone(), y.clone()]);
+        // y is only reported once, and the cycle through main ends
+        assert_eq!(index.missing(&main), [y.clone()]);
+        index.update(y, symbols(&[]), vec![]);
+        assert!(index.missing(&main).is_empty());
+    }
+}
@@ -5,9 +5,7 @@ pub trait ParentUntil: Sized {
     where
         F: Fn(&Self) -> bool;
 
-    fn parent_until_names<S>(&self, names: &[S]) -> Option<Self>
-    where
-        S: AsRef<str>;
+    fn parent_until_kinds(&self, kinds: &[u16]) -> Option<Self>;
 }
 
 impl ParentUntil for Node<'_> {
@@ -16,20 +14,19 @@ impl ParentUntil for Node<'_> {
     where
         F: Fn(&Self) -> bool,
     {
-        self.parent().and_then(|parent| {
+        let mut node = self.parent();
+        while let Some(parent) = node {
             if pred(&parent) {
-                Some(parent)
-            } else {
-                parent.parent_until(pred)
+                return Some(parent);
             }
-        })
+            node = parent.parent();
+        }
+        None
     }
 
-    /// Search parents of `self` until it's name is included in `names`.
-    fn parent_until_names<S>(&self, names: &[S]) -> Option<Self>
-    where
-        S: AsRef<str>,
-    {
-        self.parent_until(|p| names.iter().any(|n| p.kind() == n.as_ref()))
+    /// Search parents of `self` until its kind is included in `kinds`, which
+    /// are ids from `node_kind`.
+    fn parent_until_kinds(&self, kinds: &[u16]) -> Option<Self> {
+        self.parent_until(|p| kinds.contains(&p.kind_id()))
     }
 }
@@ -1,14 +1,24 @@
 {
+  "variables": {
+    # the tree-sitter runtime that `parseAsync` parses with, vendored by the
+    # `tree-sitter` node package
+    "tree_sitter_lib": "<!(node -p \"require('path').join(require('path').dirname(require.resolve('tree-sitter/package.json')), 'vendor', 'tree-sitter', 'lib')\")",
+  },
   "targets": [
     {
       "target_name": "tree_sitter_calyx_binding",
+      "dependencies": [
+        "<!(node -p \"require('node-addon-api').targets\"):node_addon_api_except",
+      ],
       "include_dirs": [
-        "<!(node -e \"require('nan')\")",
-        "src"
+        "src",
+        "<(tree_sitter_lib)/include",
+        "<(tree_sitter_lib)/src",
       ],
       "sources": [
         "bindings/node/binding.cc",
         "src/parser.c",
+        "<(tree_sitter_lib)/src/lib.c",
         # If your language uses an external scanner, add it here.
       ],
       "cflags_c": [
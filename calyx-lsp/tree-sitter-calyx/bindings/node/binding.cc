@@ -1,28 +1,209 @@
-#include "tree_sitter/parser.h"
-#include <node.h>
-#include "nan.h"
-
-using namespace v8;
+#include "tree_sitter/api.h"
+#include <napi.h>
+#include <stdlib.h>
+#include <vector>
 
 extern "C" TSLanguage * tree_sitter_calyx();
 
 namespace {
 
-NAN_METHOD(New) {}
+// "tree-sitter", "language" hashed with BLAKE2. This is the tag that the
+// `tree-sitter` package checks for in `Parser.setLanguage`.
+const napi_type_tag LANGUAGE_TYPE_TAG = {
+  0x8AF2E5212AD58ABF, 0xD5006CAD83ABBA16
+};
+
+// Tags the External that `Tree::NewInstance` passes to the constructor, so
+// that `Tree` can't be constructed from JS, e.g. as `new tree.constructor()`.
+const napi_type_tag TREE_TYPE_TAG = {
+  0x8AFDD99771DFE1CE, 0x804562C3991F6C10
+};
+
+// Marks the root in the parent column of `Tree.export`.
+const uint32_t NO_PARENT = UINT32_MAX;
+
+// Visit every node under `root` in pre-order, calling
+// `visit(node, index, parent)` where `index` counts the visited nodes and
+// `parent` is the index of the node's parent.
+template <typename F>
+void Preorder(TSNode root, F visit) {
+  TSTreeCursor cursor = ts_tree_cursor_new(root);
+  std::vector<uint32_t> parents;
+  uint32_t index = 0;
+  for (;;) {
+    visit(ts_tree_cursor_current_node(&cursor), index,
+          parents.empty() ? NO_PARENT : parents.back());
+    if (ts_tree_cursor_goto_first_child(&cursor)) {
+      parents.push_back(index++);
+      continue;
+    }
+    index++;
+    while (!ts_tree_cursor_goto_next_sibling(&cursor)) {
+      if (!ts_tree_cursor_goto_parent(&cursor)) {
+        ts_tree_cursor_delete(&cursor);
+        return;
+      }
+      parents.pop_back();
+    }
+  }
+}
+
+// A syntax tree produced by `parseAsync`.
+class Tree : public Napi::ObjectWrap<Tree> {
+ public:
+  static Napi::Function Init(Napi::Env env) {
+    return DefineClass(env, "Tree", {
+      InstanceMethod("toString", &Tree::ToString),
+      InstanceMethod("hasError", &Tree::HasError),
+      InstanceMethod("export", &Tree::Export),
+    });
+  }
+
+  // Wrap `tree` in a new JS object, which takes ownership of it.
+  static Napi::Object NewInstance(Napi::Env env, TSTree *tree) {
+    auto token = Napi::External<TSTree>::New(env, tree);
+    token.TypeTag(&TREE_TYPE_TAG);
+    return env.GetInstanceData<Napi::FunctionReference>()->New({token});
+  }
+
+  Tree(const Napi::CallbackInfo &info)
+      : Napi::ObjectWrap<Tree>(info), tree_(nullptr) {
+    if (info.Length() != 1 || !info[0].IsExternal() ||
+        !info[0].As<Napi::External<TSTree>>().CheckTypeTag(&TREE_TYPE_TAG)) {
+      throw Napi::TypeError::New(info.Env(),
+                                 "Trees are only created by parseAsync");
+    }
+    tree_ = info[0].As<Napi::External<TSTree>>().Data();
+  }
+
+  ~Tree() {
+    if (tree_) ts_tree_delete(tree_);
+  }
+
+ private:
+  // The S-expression of the tree.
+  Napi::Value ToString(const Napi::CallbackInfo &info) {
+    char *sexp = ts_node_string(ts_tree_root_node(tree_));
+    Napi::String result = Napi::String::New(info.Env(), sexp);
+    free(sexp);
+    return result;
+  }
+
+  Napi::Value HasError(const Napi::CallbackInfo &info) {
+    return Napi::Boolean::New(info.Env(),
+                              ts_node_has_error(ts_tree_root_node(tree_)));
+  }
+
+  // Export every node of the tree, in pre-order, as one Uint32Array of
+  // (symbol, start byte, end byte, parent) records. `parent` is the index of
+  // the parent's record, or 0xFFFFFFFF for the root. Symbol names are in
+  // the binding's `symbolNames`.
+  Napi::Value Export(const Napi::CallbackInfo &info) {
+    TSNode root = ts_tree_root_node(tree_);
+    size_t count = 0;
+    Preorder(root, [&](TSNode, uint32_t, uint32_t) { count++; });
 
-void Init(Local<Object> exports, Local<Object> module) {
-  Local<FunctionTemplate> tpl = Nan::New<FunctionTemplate>(New);
-  tpl->SetClassName(Nan::New("Language").ToLocalChecked());
-  tpl->InstanceTemplate()->SetInternalFieldCount(1);
+    Napi::Uint32Array records = Napi::Uint32Array::New(info.Env(), 4 * count);
+    uint32_t *data = records.Data();
+    Preorder(root, [&](TSNode node, uint32_t index, uint32_t parent) {
+      uint32_t *record = data + 4 * index;
+      record[0] = ts_node_symbol(node);
+      record[1] = ts_node_start_byte(node);
+      record[2] = ts_node_end_byte(node);
+      record[3] = parent;
+    });
+    return records;
+  }
 
-  Local<Function> constructor = Nan::GetFunction(tpl).ToLocalChecked();
-  Local<Object> instance = constructor->NewInstance(Nan::GetCurrentContext()).ToLocalChecked();
-  Nan::SetInternalFieldPointer(instance, 0, tree_sitter_calyx());
+  TSTree *tree_;
+};
 
-  Nan::Set(instance, Nan::New("name").ToLocalChecked(), Nan::New("calyx").ToLocalChecked());
-  Nan::Set(module, Nan::New("exports").ToLocalChecked(), instance);
+// Parses a buffer on the libuv threadpool. The buffer is read in place, and
+// is kept alive until the parse is done. Its length must fit in a uint32_t.
+class ParseWorker : public Napi::AsyncWorker {
+ public:
+  ParseWorker(Napi::Env env, Napi::Buffer<char> buffer)
+      : Napi::AsyncWorker(env, "tree-sitter-calyx:parse"),
+        deferred_(Napi::Promise::Deferred::New(env)),
+        buffer_(Napi::Persistent(buffer)),
+        data_(buffer.Data()),
+        length_(static_cast<uint32_t>(buffer.Length())),
+        tree_(nullptr) {}
+
+  ~ParseWorker() {
+    if (tree_) ts_tree_delete(tree_);
+  }
+
+  Napi::Promise Promise() { return deferred_.Promise(); }
+
+  void Execute() override {
+    TSParser *parser = ts_parser_new();
+    ts_parser_set_language(parser, tree_sitter_calyx());
+    tree_ = ts_parser_parse_string(parser, nullptr, data_, length_);
+    ts_parser_delete(parser);
+    if (!tree_) SetError("Unable to parse");
+  }
+
+  void OnOK() override {
+    deferred_.Resolve(Tree::NewInstance(Env(), tree_));
+    tree_ = nullptr;
+  }
+
+  void OnError(const Napi::Error &error) override {
+    deferred_.Reject(error.Value());
+  }
+
+ private:
+  Napi::Promise::Deferred deferred_;
+  Napi::Reference<Napi::Buffer<char>> buffer_;
+  const char *data_;
+  uint32_t length_;
+  TSTree *tree_;
+};
+
+// _parseAsync(buffer): parse the UTF-8 source in `buffer` off the main
+// thread. Returns a promise for the `Tree`.
+Napi::Value ParseAsync(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  if (info.Length() < 1 || !info[0].IsBuffer()) {
+    throw Napi::TypeError::New(env, "Expected a Buffer");
+  }
+  Napi::Buffer<char> buffer = info[0].As<Napi::Buffer<char>>();
+  // tree-sitter takes the length of its input as a uint32_t
+  if (buffer.Length() > UINT32_MAX) {
+    throw Napi::RangeError::New(env, "Buffer is larger than 4 GiB");
+  }
+  ParseWorker *worker = new ParseWorker(env, buffer);
+  Napi::Promise promise = worker->Promise();
+  worker->Queue();
+  return promise;
+}
+
+// The name of every symbol in the grammar, indexed by symbol id.
+Napi::Array SymbolNames(Napi::Env env) {
+  const TSLanguage *language = tree_sitter_calyx();
+  uint32_t count = ts_language_symbol_count(language);
+  Napi::Array names = Napi::Array::New(env, count);
+  for (uint32_t symbol = 0; symbol < count; symbol++) {
+    names[symbol] = Napi::String::New(
+        env, ts_language_symbol_name(language, (TSSymbol)symbol));
+  }
+  return names;
 }
 
-NODE_MODULE(tree_sitter_calyx_binding, Init)
+Napi::Object Init(Napi::Env env, Napi::Object exports) {
+  env.SetInstanceData(
+      new Napi::FunctionReference(Napi::Persistent(Tree::Init(env))));
+
+  exports["name"] = Napi::String::New(env, "calyx");
+  auto language = Napi::External<TSLanguage>::New(env, tree_sitter_calyx());
+  language.TypeTag(&LANGUAGE_TYPE_TAG);
+  exports["language"] = language;
+  exports["symbolNames"] = SymbolNames(env);
+  exports["_parseAsync"] = Napi::Function::New(env, ParseAsync);
+  return exports;
+}
 
 }  // namespace
+
+NODE_API_MODULE(tree_sitter_calyx_binding, Init)
@@ -14,6 +14,31 @@ try {
   }
 }
 
+// Parse `input`, a string or a Buffer of UTF-8 source, on the libuv
+// threadpool. Buffers are parsed in place, without copying them. Resolves to
+// a `Tree`.
+module.exports.parseAsync = function parseAsync(input) {
+  const buffer = Buffer.isBuffer(input) ? input : Buffer.from(input, "utf8");
+  return module.exports._parseAsync(buffer);
+};
+
+// Yield every node of `tree`, in pre-order, as `{ type, startIndex,
+// endIndex, parent }`, where `parent` is the index of the parent node or -1
+// for the root. All nodes come from a single typed array, so this doesn't
+// allocate native objects.
+module.exports.exportTree = function* exportTree(tree) {
+  const records = tree.export();
+  const names = module.exports.symbolNames;
+  for (let i = 0; i < records.length; i += 4) {
+    yield {
+      type: names[records[i]],
+      startIndex: records[i + 1],
+      endIndex: records[i + 2],
+      parent: records[i + 3] === 0xffffffff ? -1 : records[i + 3],
+    };
+  }
+};
+
 try {
   module.exports.nodeTypeInfo = require("../../src/node-types.json");
 } catch (_) {}
@@ -0,0 +1,24 @@
+#!/bin/sh
+# Build tree-sitter-calyx.wasm, a WebAssembly build of the Calyx parser that
+# web-tree-sitter can load. Requires emscripten (`emcc`) on the path.
+#
+# The output is a side module that only exports `tree_sitter_calyx`; the
+# tree-sitter runtime itself comes from web-tree-sitter. Almost all of
+# parser.c is constant parse tables and a generated lexer, so we optimize for
+# size (`-Os`, which also has emcc run `wasm-opt`): the lexer's switch
+# statements gain little from -O3 and the tables are the same either way.
+set -eu
+
+cd "$(dirname "$0")/../.."
+out="${1:-bindings/wasm/tree-sitter-calyx.wasm}"
+
+emcc -o "$out" \
+  -Os \
+  -fno-exceptions \
+  -s WASM=1 \
+  -s SIDE_MODULE=2 \
+  -s 'EXPORTED_FUNCTIONS=["_tree_sitter_calyx"]' \
+  -I src \
+  src/parser.c
+
+echo "wrote $out"
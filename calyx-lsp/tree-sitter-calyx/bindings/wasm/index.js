@@ -0,0 +1,27 @@
+// Load the WebAssembly build of the Calyx parser (see build.sh) with
+// web-tree-sitter.
+//
+//   import { loadCalyx } from "tree-sitter-calyx/bindings/wasm/index.js";
+//   const parser = await loadCalyx();
+//   const tree = parser.parse(source);
+import Parser from "web-tree-sitter";
+
+let language = null;
+
+// Return the Calyx `Language`, loading it from `wasmUrl` the first time that
+// this is called.
+export function loadLanguage(
+  wasmUrl = new URL("./tree-sitter-calyx.wasm", import.meta.url).href
+) {
+  if (language === null) {
+    language = Parser.init().then(() => Parser.Language.load(wasmUrl));
+  }
+  return language;
+}
+
+// Return a new parser for Calyx.
+export async function loadCalyx(wasmUrl) {
+  const parser = new Parser();
+  parser.setLanguage(await loadLanguage(wasmUrl));
+  return parser;
+}
@@ -0,0 +1,70 @@
+import hashlib
+import logging as log
+import os
+import shutil
+from pathlib import Path
+from typing import Iterable, Optional, Union
+
+
+class ResultCache:
+    """
+    A content-addressed cache of the directories produced by Vivado runs.
+
+    Each entry is a copy of a run's output directory, stored under a key that
+    hashes everything that went into the run: the design, the device files,
+    and the command line. Entries are written to a private directory and then
+    renamed into place, so several `fud` processes can share a cache.
+    """
+
+    def __init__(self, root: Path):
+        self.root = root
+
+    @staticmethod
+    def key(parts: Iterable[Union[str, bytes]]) -> str:
+        """
+        Hash `parts` into a cache key. Every part is prefixed with its length,
+        so that moving bytes from one part to the next changes the key.
+        """
+        h = hashlib.sha256()
+        for part in parts:
+            if isinstance(part, str):
+                part = part.encode("UTF-8")
+            h.update(len(part).to_bytes(8, "little"))
+            h.update(part)
+        return h.hexdigest()
+
+    def lookup(self, key: str) -> Optional[Path]:
+        """
+        Return the directory stored under `key`, if there is one.
+        """
+        entry = self.root / key
+        return entry if entry.is_dir() else None
+
+    def restore(self, key: str, dest: Path):
+        """
+        Copy the contents of the entry for `key` into the directory `dest`.
+        """
+        for child in (self.root / key).iterdir():
+            if child.is_dir():
+                shutil.copytree(child, dest / child.name, symlinks=True)
+            else:
+                shutil.copy2(child, dest / child.name)
+
+    def store(self, key: str, directory: Path):
+        """
+        Store a copy of `directory` under `key`, unless there is already an
+        entry for it.
+        """
+        entry = self.root / key
+        if entry.exists():
+            return
+        self.root.mkdir(parents=True, exist_ok=True)
+        staging = self.root / f".{key}.{os.getpid()}"
+        try:
+            shutil.copytree(directory, staging, symlinks=True)
+            os.rename(staging, entry)
+        except OSError as e:
+            # another process stored the same entry in the meantime, or the
+            # cache is unwritable; either way, the result is still good
+            log.warning(f"Unable to cache results in {entry}: {e}")
+            shutil.rmtree(staging, ignore_errors=True)
@@ -2,6 +2,7 @@ import json
 import os
 from pathlib import Path, PurePath
 import re
+from typing import Optional
 import traceback
 import logging as log
 
@@ -32,6 +33,25 @@ def to_int(s):
     return int(s)
 
 
+def cycles(s):
+    """
+    Parse a cycle count from an HLS report. Unknown counts (`?`) and counts
+    that don't apply (`-`) are None.
+    """
+    return int(s) if s.isdigit() else None
+
+
+def column(row, *names):
+    """
+    Get the first of the columns `names` that `row` has. Versions of Vivado
+    HLS name some columns differently.
+    """
+    for name in names:
+        if name in row:
+            return row[name]
+    raise Exception(f"None of the columns {', '.join(names)} were found")
+
+
 def file_contains(regex, filename):
     strings = re.findall(regex, filename.open().read())
     return len(strings) == 0
@@ -176,7 +196,125 @@ def place_and_route_extract(
     return json.dumps(resource_info, indent=2)
 
 
-def hls_extract(directory: Path, top: str):
+def hls_performance(report: Path):
+    """
+    Extract the estimated clock, the latency and initiation interval of a
+    function, and the latency, trip count and achieved initiation interval of
+    each of its loops from the function's csynth report.
+    """
+    # Times are reported as `7.00` or `7.00 ns`
+    def ns(s):
+        return float(s.split()[0])
+
+    parser = rpt.RPTParser(report)
+    clock = parser.get_table(re.compile(r"^\+ Timing"), 1)[0]
+    summary = parser.get_table(re.compile(r"^\+ Latency"), 1, multi_header=True)[0]
+    loops = parser.get_table(
+        re.compile(r"\* Loop:"), 0, multi_header=True, certain=False
+    )
+
+    return {
+        "clock": {
+            "target": ns(clock["Target"]),
+            "estimated": ns(clock["Estimated"]),
+            "uncertainty": ns(clock["Uncertainty"]),
+        },
+        "latency": {
+            "min": cycles(column(summary, "Latency (cycles) min", "Latency min")),
+            "max": cycles(column(summary, "Latency (cycles) max", "Latency max")),
+        },
+        "interval": {
+            "min": cycles(summary["Interval min"]),
+            "max": cycles(summary["Interval max"]),
+        },
+        "pipeline": summary["Pipeline Type"],
+        "loops": [
+            {
+                # nested loops are marked with `+` and outer ones with `-`
+                "name": loop["Loop Name"].lstrip("-+ "),
+                "latency": {
+                    "min": cycles(
+                        column(loop, "Latency (cycles) min", "Latency min")
+                    ),
+                    "max": cycles(
+                        column(loop, "Latency (cycles) max", "Latency max")
+                    ),
+                },
+                "iteration_latency": cycles(loop["Iteration Latency"]),
+                "ii": {
+                    "achieved": cycles(loop["Initiation Interval achieved"]),
+                    "target": cycles(loop["Initiation Interval target"]),
+                },
+                "trip_count": cycles(loop["Trip Count"]),
+                "pipelined": loop["Pipelined"] == "yes",
+            }
+            for loop in loops or []
+        ],
+    }
+
+
+# Metrics for which an increase over the baseline is a regression
+LOWER_IS_BETTER = {
+    "lut",
+    "ff",
+    "dsp",
+    "avg_latency",
+    "best_latency",
+    "worst_latency",
+    "ii",
+    "min",
+    "max",
+    "iteration_latency",
+    "achieved",
+    "estimated",
+}
+
+
+def flatten(value, prefix=""):
+    """
+    Flatten nested estimates into a dict from dotted paths to values. Loops
+    are keyed by their names rather than their positions.
+    """
+    if isinstance(value, dict):
+        items = value.items()
+    elif isinstance(value, list):
+        items = ((v["name"], v) for v in value)
+    else:
+        return {prefix: value}
+
+    flat = {}
+    for key, v in items:
+        if key != "name":
+            flat.update(flatten(v, f"{prefix}.{key}" if prefix else key))
+    return flat
+
+
+def diff_baseline(result, baseline):
+    """
+    Compare the estimates in `result` against an earlier `baseline`, and
+    list the metrics that changed and those that got worse.
+    """
+    # the top-level `ii` is a copy of `functions.<top>.interval.max`, which is
+    # already compared
+    skip = {"baseline", "ii"}
+    current = flatten({k: v for k, v in result.items() if k not in skip})
+    previous = flatten({k: v for k, v in baseline.items() if k not in skip})
+
+    changed = {}
+    regressions = []
+    for path in sorted(current.keys() | previous.keys()):
+        now, then = current.get(path), previous.get(path)
+        if now == then:
+            continue
+        changed[path] = {"baseline": then, "current": now}
+        numeric = all(isinstance(v, (int, float)) for v in (now, then))
+        if numeric and path.split(".")[-1] in LOWER_IS_BETTER and now > then:
+            log.warning(f"Regression in {path}: {then} -> {now}")
+            regressions.append(path)
+    return {"changed": changed, "regressions": regressions}
+
+
+def hls_extract(directory: Path, top: str, baseline: Optional[Path] = None):
     # Search for directory named benchmark.prj
     for root, dirs, _ in os.walk(directory):
         for d in dirs:
@@ -197,17 +335,27 @@ def hls_extract(directory: Path, top: str):
         total_row = find_row(summary_table, "Name", "Total")
         s_axi_row = find_row(instance_table, "Instance", f"{top}_control_s_axi_U")
 
-        return json.dumps(
-            {
-                "total_lut": to_int(total_row["LUT"]),
-                "instance_lut": to_int(s_axi_row["LUT"]),
-                "lut": to_int(total_row["LUT"]) - to_int(s_axi_row["LUT"]),
-                "dsp": to_int(total_row["DSP48E"]) - to_int(s_axi_row["DSP48E"]),
-                "avg_latency": to_int(latency["LatencyAvg"]),
-                "best_latency": to_int(latency["LatencyBest"]),
-                "worst_latency": to_int(latency["LatencyWorst"]),
-            },
-            indent=2,
-        )
+        # every function that isn't inlined gets its own report
+        suffix = "_csynth.rpt"
+        functions = {
+            report.name[: -len(suffix)]: hls_performance(report)
+            for report in sorted((directory / "syn" / "report").glob(f"*{suffix}"))
+        }
+
+        result = {
+            "total_lut": to_int(total_row["LUT"]),
+            "instance_lut": to_int(s_axi_row["LUT"]),
+            "lut": to_int(total_row["LUT"]) - to_int(s_axi_row["LUT"]),
+            "ff": to_int(total_row["FF"]) - to_int(s_axi_row["FF"]),
+            "dsp": to_int(total_row["DSP48E"]) - to_int(s_axi_row["DSP48E"]),
+            "avg_latency": to_int(latency["LatencyAvg"]),
+            "best_latency": to_int(latency["LatencyBest"]),
+            "worst_latency": to_int(latency["LatencyWorst"]),
+            "ii": functions[top]["interval"]["max"],
+            "functions": functions,
+        }
+        if baseline is not None:
+            result["baseline"] = diff_baseline(result, json.load(baseline.open()))
+        return json.dumps(result, indent=2)
     except FileNotFoundError as e:
         raise errors.MissingFile(e.filename)
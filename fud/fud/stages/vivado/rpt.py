@@ -111,6 +111,9 @@ class RPTParser:
         # Extract the headers and set table start
         table_start = 0
         if multi_header:
+            # Multi headers don't get an index column for the indentation of
+            # the table, so drop it from the rows too.
+            table_lines = [line.strip() for line in table_lines]
             header = RPTParser._parse_multi_header(table_lines[1:3])
             table_start = 3
         else:
@@ -131,10 +134,11 @@ class RPTParser:
         ]
         return ret
 
-    def get_table(self, reg, off, multi_header=False):
+    def get_table(self, reg, off, multi_header=False, certain=True):
         """
         Parse table `off` lines after `reg` matches the files in the current
-        file.
+        file. If `certain` is false, return None when there is no such table
+        (Vivado HLS prints `N/A` in place of empty tables).
 
         The table format is:
         +--------+-------+----------+------------+
@@ -163,6 +167,8 @@ class RPTParser:
                 while self.lines[end].strip() != "":
                     end += 1
 
+        if not certain and end <= start:
+            return None
         assert end > start, "Failed to find table start for {}.".format(reg)
 
         return self._parse_table(self.lines[start:end], multi_header)
@@ -1,12 +1,14 @@
 import shutil
 from pathlib import Path, PurePath
+import logging as log
 import os
 
-from fud.stages import SourceType, Stage
+from fud.stages import ComputationGraph, Source, SourceType, Stage
 from fud.stages.remote_context import RemoteExecution
 from fud.utils import TmpDir, shell
 from fud import config as cfg
 
+from .cache import ResultCache
 from .extract import hls_extract, place_and_route_extract
 
 
@@ -48,13 +50,74 @@ class VivadoBaseStage(Stage):
         """
         return ""
 
-    def _define_steps(self, verilog_path, builder, config):
-        use_ssh = bool(config.get(["stages", self.name, "remote"]))
+    def result_marker(self, config):
+        """
+        Glob pattern for a file that only a successful run produces. Results
+        are only cached when the output directory contains a match.
+        """
+        return "*"
+
+    def command(self, config):
         flags = f"{self.flags} {self.extra_flags(config)}"
-        if use_ssh:
-            cmd = f"{config['stages', self.name, 'exec']} {flags}"
+        if bool(config.get(["stages", self.name, "remote"])):
+            return f"{config['stages', self.name, 'exec']} {flags}"
         else:
-            cmd = f"{self.remote_exec} {flags}"
+            return f"{self.remote_exec} {flags}"
+
+    def tmpdir(self, config):
+        if ["stages", self.name, "tmpdir"] in config:
+            return TmpDir(config["stages", self.name, "tmpdir"])
+        else:
+            return TmpDir()
+
+    def _define_steps(self, verilog_path, builder, config):
+        cache_dir = config.get(["stages", self.name, "cache_dir"])
+        if not cache_dir:
+            return self._run(verilog_path, builder, config)
+
+        cache = ResultCache(Path(cache_dir).expanduser())
+
+        @builder.step()
+        def cached_run(verilog_path: SourceType.Path) -> SourceType.Directory:
+            """
+            Reuse the results of an earlier identical run, or run Vivado and
+            cache its results.
+            """
+            key = ResultCache.key(
+                [
+                    self.name,
+                    self.command(config),
+                    verilog_path.read_bytes(),
+                    *(
+                        part
+                        for f in self.device_files(config)
+                        for part in (os.path.basename(f), Path(f).read_bytes())
+                    ),
+                ]
+            )
+            if cache.lookup(key):
+                log.info(f"Reusing cached results {key}")
+                tmpdir = self.tmpdir(config)
+                cache.restore(key, Path(tmpdir.name))
+                return tmpdir
+
+            # run the uncached steps as a graph of their own
+            run = ComputationGraph(SourceType.Path, SourceType.Directory)
+            run.output = self._run(run._input, run, config)
+            for step in run.get_steps(Source(verilog_path, SourceType.Path)):
+                step()
+            output = Path(run.output.data.name)
+            if any(output.rglob(self.result_marker(config))):
+                cache.store(key, output)
+            else:
+                log.warning(f"Not caching results of a failed run in {output}")
+            return run.output.data
+
+        return cached_run(verilog_path)
+
+    def _run(self, verilog_path, builder, config):
+        use_ssh = bool(config.get(["stages", self.name, "remote"]))
+        cmd = self.command(config)
 
         # Steps and schedule
         local_tmpdir = self.setup_environment(verilog_path, builder, config)
@@ -81,10 +144,7 @@ class VivadoBaseStage(Stage):
             """
             Make temporary directory to store Vivado synthesis files.
             """
-            if ["stages", self.name, "tmpdir"] in config:
-                return TmpDir(config["stages", self.name, "tmpdir"])
-            else:
-                return TmpDir()
+            return self.tmpdir(config)
 
         @builder.step()
         def local_move_files(
@@ -139,6 +199,9 @@ class VivadoStage(VivadoBaseStage):
             tcl = root / "fud" / "synth" / "synth.tcl"
         return [tcl, constraints]
 
+    def result_marker(self, config):
+        return "main_utilization_placed.rpt"
+
 
 class VivadoHLSStage(VivadoBaseStage):
     name = "vivado-hls"
@@ -164,6 +227,9 @@ class VivadoHLSStage(VivadoBaseStage):
         top = config.get(["stages", self.name, "top"])
         return f"-tclargs top {top}" if top else ""
 
+    def result_marker(self, config):
+        return "*_csynth.rpt"
+
 
 class VivadoHLSPlaceAndRouteStage(VivadoBaseStage):
     name = "vivado-hls"
@@ -189,6 +255,9 @@ class VivadoHLSPlaceAndRouteStage(VivadoBaseStage):
         top = config.get(["stages", self.name, "top"])
         return f"top {top}" if top else ""
 
+    def result_marker(self, config):
+        return "*_utilization_routed.rpt"
+
 
 class VivadoExtractStage(Stage):
     name = "synth-files"
@@ -238,7 +307,12 @@ class VivadoHLSExtractStage(Stage):
             Extract relevant data from Vivado synthesis files.
             """
             top = config.get(["stages", self.name, "top"]) or "kernel"
-            return hls_extract(Path(directory.name), top)
+            baseline = config.get(["stages", self.name, "baseline"])
+            return hls_extract(
+                Path(directory.name),
+                top,
+                Path(baseline).expanduser() if baseline else None,
+            )
 
         return extract(input)
 
@@ -91,6 +91,8 @@ ALL TIMES.
 
 #include <cassert>
 #include <ap_fixed.h>
+#include <ap_axi_sdata.h>
+#include <hls_stream.h>
 using namespace std;
 
 // Fixed point square-root template
@@ -173,9 +175,564 @@ void fxp_sqrt(ap_ufixed<W2,IW2>& result, ap_ufixed<W1,IW1>& in_val)
    result.range(W2-1,0) = ap_uint<W2>(q >> 1);
 }
 
+// Pipelined fixed point square-root template
+//
+// Basic usage: fxp_sqrt_pipelined(root_var, radicand_var);
+//          or: fxp_sqrt_pipelined<ITERS_PER_STAGE>(root_var, radicand_var);
+//
+// Description:
+// Computes the same (bit-identical) result as fxp_sqrt<> above, but with the
+// non-restoring loop fully unrolled and its ROOT_PREC+1 iterations split into
+// register-separated pipeline stages, so that a new radicand is accepted
+// every cycle (II=1).
+//
+// ITERS_PER_STAGE sets how many iterations are chained combinationally
+// within one stage.  Each stage is a separate, non-inlined instance of
+// fxp_sqrt_stage<>, itself pipelined at II=1 with a latency of one cycle,
+// so its outputs are registered; the intended function latency is therefore
+// ceil((ROOT_PREC+1)/ITERS_PER_STAGE) cycles: small values shorten the
+// critical path at the cost of more pipeline registers, large values trade
+// Fmax for fewer registers.  The II and latency have not yet been confirmed
+// from a csynth report (`python3 tools/fxp-sqrt-sweep/sweep.py --modes
+// pipelined:1 pipelined:4` reports both).  The remaining template
+// parameters are inferred from the argument types as for fxp_sqrt<>.
+
+// Stage ST of fxp_sqrt_pipelined<>: iterations ST*ITERS_PER_STAGE up to the
+// next stage's of the non-restoring loop.  The stage number is a template
+// parameter so that every stage is its own function.
+template <int ST, int ITERS_PER_STAGE, int QW, int ROOT_PREC>
+void fxp_sqrt_stage(ap_int<QW+2>& s, ap_uint<QW>& q, ap_uint<QW>& q_star)
+{
+#pragma HLS INLINE off
+#pragma HLS PIPELINE II=1
+#pragma HLS LATENCY min=1 max=1
+   ITER: for (int j = 0; j < ITERS_PER_STAGE; j++) {
+#pragma HLS UNROLL
+      const int i = ST * ITERS_PER_STAGE + j;
+      if (i <= ROOT_PREC) {
+         if (s >= 0) {
+            s = 2 * s - (((ap_int<QW+2>(q) << 2) | 1) << (ROOT_PREC - i));
+            q_star = q << 1;
+            q = (q << 1) | 1;
+         } else {
+            s = 2 * s + (((ap_int<QW+2>(q_star) << 2) | 3) << (ROOT_PREC - i));
+            q = (q_star << 1) | 1;
+            q_star <<= 1;
+         }
+      }
+   }
+}
+
+// Chains stages ST up to STAGES-1 of fxp_sqrt_pipelined<>.
+template <int ST, int STAGES, int ITERS_PER_STAGE, int QW, int ROOT_PREC>
+struct fxp_sqrt_stages {
+   static void run(ap_int<QW+2>& s, ap_uint<QW>& q, ap_uint<QW>& q_star)
+   {
+#pragma HLS INLINE
+      fxp_sqrt_stage<ST, ITERS_PER_STAGE, QW, ROOT_PREC>(s, q, q_star);
+      fxp_sqrt_stages<ST+1, STAGES, ITERS_PER_STAGE, QW, ROOT_PREC>::run(s, q, q_star);
+   }
+};
+
+template <int STAGES, int ITERS_PER_STAGE, int QW, int ROOT_PREC>
+struct fxp_sqrt_stages<STAGES, STAGES, ITERS_PER_STAGE, QW, ROOT_PREC> {
+   static void run(ap_int<QW+2>&, ap_uint<QW>&, ap_uint<QW>&) {}
+};
+
+template <int ITERS_PER_STAGE = 1, int W2, int IW2, int W1, int IW1>
+void fxp_sqrt_pipelined(ap_ufixed<W2,IW2>& result, ap_ufixed<W1,IW1>& in_val)
+{
+#pragma HLS PIPELINE II=1
+   enum { QW = (IW1+1)/2 + (W2-IW2) + 1 }; // derive max root width
+   enum { SCALE = (W2 - W1) - (IW2 - (IW1+1)/2) }; // scale (shift) to adj initial remainer value
+   enum { ROOT_PREC = QW - (IW1 % 2) };
+   enum { STAGES = (ROOT_PREC + ITERS_PER_STAGE) / ITERS_PER_STAGE }; // ceil((ROOT_PREC+1)/ITERS_PER_STAGE)
+   static_assert(ITERS_PER_STAGE >= 1, "fxp_sqrt_pipelined: ITERS_PER_STAGE must be positive");
+   assert((IW1+1)/2 <= IW2); // Check that output format can accommodate full result
+
+   ap_uint<QW> q      = 0;   // partial sqrt
+   ap_uint<QW> q_star = 0;   // diminished partial sqrt
+   ap_int<QW+2> s; // scaled remainder initialized to extracted input bits
+   if (SCALE >= 0)
+      s = in_val.range(W1-1,0) << (SCALE);
+   else
+      s = ((in_val.range(W1-1,0) >> (0 - (SCALE + 1))) + 1) >> 1;
+
+   // Non-restoring square-root algorithm, one register stage per
+   // ITERS_PER_STAGE iterations
+   fxp_sqrt_stages<0, STAGES, ITERS_PER_STAGE, QW, ROOT_PREC>::run(s, q, q_star);
+   // Round result by "extra iteration" method
+   if (s > 0)
+      q = q + 1;
+   // Truncate excess bit and assign to output format
+   result.range(W2-1,0) = ap_uint<W2>(q >> 1);
+}
+
+// Batched fixed point square-root template
+//
+// Basic usage: fxp_sqrt_batch<N>(root_array, radicand_array);
+//          or: fxp_sqrt_batch<N,ITERS_PER_STAGE>(root_array, radicand_array);
+//
+// Description:
+// Computes N independent square-roots per cycle by instantiating N parallel
+// lanes of fxp_sqrt_pipelined<ITERS_PER_STAGE>.  Both arrays are completely
+// partitioned so that every lane has its own ports; callers passing arrays
+// from a larger kernel should partition them the same way (or cyclically by
+// a factor of N) to avoid reintroducing a memory port bottleneck.  Results
+// are bit-identical to calling fxp_sqrt<> on each element.
+
+template <int N, int ITERS_PER_STAGE = 1, int W2, int IW2, int W1, int IW1>
+void fxp_sqrt_batch(ap_ufixed<W2,IW2> root[N], ap_ufixed<W1,IW1> radicand[N])
+{
+#pragma HLS PIPELINE II=1
+#pragma HLS ARRAY_PARTITION variable=root complete dim=1
+#pragma HLS ARRAY_PARTITION variable=radicand complete dim=1
+   static_assert(N >= 1, "fxp_sqrt_batch: N must be positive");
+
+   LANE: for (int n = 0; n < N; n++) {
+#pragma HLS UNROLL
+      fxp_sqrt_pipelined<ITERS_PER_STAGE>(root[n], radicand[n]);
+   }
+}
+
+// Streaming fixed point square-root templates
+//
+// Basic usage: fxp_sqrt_stream(root_stream, radicand_stream, n);
+//          or: fxp_sqrt_stream<ITERS_PER_STAGE>(root_stream, radicand_stream, n);
+//          or: fxp_sqrt_axis<W2,IW2,W1,IW1>(root_axis, radicand_axis);
+//          or: fxp_sqrt_axis<W2,IW2,W1,IW1,ITERS_PER_STAGE>(root_axis, radicand_axis);
+//
+// Description:
+// fxp_sqrt_stream<> reads n radicands from an hls::stream<ap_ufixed<W1,IW1> >
+// and writes their roots, in order, to an hls::stream<ap_ufixed<W2,IW2> >,
+// through one lane of fxp_sqrt_pipelined<ITERS_PER_STAGE> at II=1.  It
+// accesses each stream once per element and nothing else, so it can be a
+// process of a DATAFLOW region and chained with other streaming stages:
+//
+//    void kernel(hls::stream<in_t>& in, hls::stream<root_t>& out, int n) {
+//    #pragma HLS INTERFACE axis port=in
+//    #pragma HLS INTERFACE axis port=out
+//    #pragma HLS INTERFACE s_axilite port=n
+//    #pragma HLS INTERFACE s_axilite port=return
+//    #pragma HLS DATAFLOW
+//       hls::stream<radicand_t> mid;
+//       scale(mid, in, n);
+//       fxp_sqrt_stream(out, mid, n);
+//    }
+//
+// fxp_sqrt_axis<> does the same on AXI-Stream packets (ap_axiu<> or
+// hls::axis<>) for kernels whose ports are AXI-Stream interfaces: the
+// radicand is the low W1 bits of TDATA and the root is written to the low
+// W2 bits, the root packet has TKEEP and TSTRB set, and TLAST is passed
+// through.  It runs until it has passed on a packet with TLAST set, so it
+// needs no element count and can serve a free-running (ap_ctrl_none) kernel.
+// TUSER, TID and TDEST are not carried over.  Both functions produce the
+// same (bit-identical) results as fxp_sqrt<>.
+
+template <int ITERS_PER_STAGE = 1, int W2, int IW2, int W1, int IW1>
+void fxp_sqrt_stream(hls::stream<ap_ufixed<W2,IW2> >& out,
+                     hls::stream<ap_ufixed<W1,IW1> >& in, int n)
+{
+   STREAM: for (int k = 0; k < n; k++) {
+#pragma HLS PIPELINE II=1
+      ap_ufixed<W1,IW1> x = in.read();
+      ap_ufixed<W2,IW2> r;
+      fxp_sqrt_pipelined<ITERS_PER_STAGE>(r, x);
+      out.write(r);
+   }
+}
+
+template <int W2, int IW2, int W1, int IW1, int ITERS_PER_STAGE = 1,
+          typename OUT_PKT, typename IN_PKT>
+void fxp_sqrt_axis(hls::stream<OUT_PKT>& out, hls::stream<IN_PKT>& in)
+{
+   bool last = false;
+   AXIS: while (!last) {
+#pragma HLS PIPELINE II=1
+      IN_PKT pkt = in.read();
+      ap_ufixed<W1,IW1> x;
+      x.range(W1-1,0) = pkt.data.range(W1-1,0);
+      ap_ufixed<W2,IW2> r;
+      fxp_sqrt_pipelined<ITERS_PER_STAGE>(r, x);
+
+      OUT_PKT res;
+      res.data = 0;
+      res.data.range(W2-1,0) = r.range(W2-1,0);
+      res.keep = -1;
+      res.strb = -1;
+      res.last = pkt.last;
+      out.write(res);
+      last = pkt.last;
+   }
+}
+
+// Fixed point square-root with a selectable algorithm
+//
+// Basic usage: fxp_sqrt<MODE>(root_var, radicand_var);
+// where MODE is one of the policy types below and the remaining template
+// parameters are inferred from the argument types as for fxp_sqrt<>.
+//
+//   fxp_sqrt_nonrestoring  the radix-2 non-restoring loop of fxp_sqrt<>
+//                          (ROOT_PREC+1 iterations, one root bit each).
+//   fxp_sqrt_radix4        radix-4 digit recurrence: two root bits per
+//                          iteration, chosen by comparing the remainder
+//                          against the three non-zero digit candidates in
+//                          parallel.  Half the iterations of radix-2, for
+//                          roughly three times the adder area per iteration.
+//   fxp_sqrt_newton        reciprocal square-root Newton-Raphson iteration,
+//                          seeded from a 48-entry table and evaluated on DSP
+//                          multipliers, followed by a one-ulp correction.
+//                          Its iteration count grows with log2 of the root
+//                          width instead of linearly.
+//
+// Unlike the radix-2 loop, which only uses as many radicand bits as fit in
+// its QW+2 bit remainder, the radix-4 and Newton-Raphson modes use the full
+// radicand.  They compute floor(sqrt()) with one extra fractional root bit
+// and round it to nearest (ties up).  A root that rounds past the largest
+// value of the output format saturates.
+//
+// The modes are therefore not bit-identical, and switching away from
+// fxp_sqrt_nonrestoring changes results: the radix-2 loop drops the
+// radicand bits below its remainder, and for some formats its remainder
+// wraps for radicands near the top of the range.  For a <16,8> radicand and
+// root, 14973 of the 65536 radicands get a different root (e.g. 255.97
+// gives 9.30 instead of 16.00).  radix4 and newton agree with each other on
+// every input, and are correctly rounded.
+
+struct fxp_sqrt_nonrestoring {};
+struct fxp_sqrt_radix4 {};
+struct fxp_sqrt_newton {};
+
+// Radicand realigned so that its integer square-root carries one more
+// fractional bit than the output format
+template <int W2, int IW2, int W1, int IW1>
+struct fxp_sqrt_aligned {
+   enum { E = 2*(W2-IW2) + 2 - (W1-IW1) }; // left shift applied to the radicand bits
+   enum { NB = (W1 + E > 1) ? W1 + E : 1 }; // significant bits after the shift
+};
+
+// Round a root with one extra LSB into the output format
+template <int RW, int W2, int IW2>
+void fxp_sqrt_round(ap_ufixed<W2,IW2>& result, ap_uint<RW> r)
+{
+   ap_uint<RW> rr = (ap_uint<RW+1>(r) + 1) >> 1;
+   if (RW > W2 && (rr >> (RW > W2 ? W2 : 0)) != 0)
+      result.range(W2-1,0) = ~ap_uint<W2>(0); // saturate
+   else
+      result.range(W2-1,0) = ap_uint<W2>(rr);
+}
+
+// 1/sqrt(m) for m in [1/4, 1) given with P fractional bits, by
+// Newton-Raphson iteration from a table seed.  The result, which is in
+// (1, 2), also has P fractional bits.
+template <int P>
+ap_uint<P+1> fxp_rsqrt_newton(ap_uint<P> mp)
+{
+   // the seed is good to ~5.5 bits and each iteration doubles that
+   enum { ITERS = P <= 10 ? 1 : P <= 20 ? 2 : P <= 40 ? 3 : P <= 80 ? 4 : 5 };
+
+   // 1/sqrt(m) for m in [(i+16)/64, (i+17)/64), with 8 fractional bits
+   static const ap_uint<10> seed[48] = {
+   504, 490, 476, 464, 452, 442, 432, 422, 414, 406, 398, 391,
+   384, 377, 371, 365, 359, 354, 349, 344, 339, 334, 330, 326,
+   322, 318, 314, 311, 307, 304, 300, 297, 294, 291, 288, 285,
+   283, 280, 277, 275, 272, 270, 268, 266, 263, 261, 259, 257,
+   };
+
+   // y_(k+1) = y_k * (3 - m * y_k^2) / 2 converges to 1/sqrt(m)
+   ap_uint<P+1> x = ap_uint<P+1>(seed[mp.range(P-1, P-6) - 16]) << (P - 8);
+   NEWTON: for (int k = 0; k < ITERS; k++) {
+      ap_uint<P+2> x2  = (ap_uint<2*P+2>(x) * x) >> P;
+      ap_uint<P+1> mx2 = (ap_uint<2*P+2>(mp) * x2) >> P;
+      ap_uint<P+2> t   = (ap_uint<P+2>(3) << P) - mx2;
+      x = (ap_uint<2*P+3>(x) * t) >> (P + 1);
+   }
+   return x;
+}
+
+// Normalize y by an even left shift z so that, as a fraction of NB bits, it
+// lies in [1/4, 1), and return its leading P bits
+template <int P, int NB>
+ap_uint<P> fxp_sqrt_normalize(ap_uint<NB> y, int& z)
+{
+   z = y.countLeadingZeros() & ~1;
+   ap_uint<NB> m = y << z;
+   if (NB > P)
+      return m >> (NB > P ? NB - P : 0);
+   else
+      return ap_uint<P>(m) << (NB > P ? 0 : P - NB);
+}
+
+template <typename MODE>
+struct fxp_sqrt_impl;
+
+template <>
+struct fxp_sqrt_impl<fxp_sqrt_nonrestoring> {
+   template <int W2, int IW2, int W1, int IW1>
+   static void run(ap_ufixed<W2,IW2>& result, ap_ufixed<W1,IW1>& in_val)
+   {
+      fxp_sqrt(result, in_val);
+   }
+};
+
+template <>
+struct fxp_sqrt_impl<fxp_sqrt_radix4> {
+   template <int W2, int IW2, int W1, int IW1>
+   static void run(ap_ufixed<W2,IW2>& result, ap_ufixed<W1,IW1>& in_val)
+   {
+      typedef fxp_sqrt_aligned<W2,IW2,W1,IW1> A;
+      enum { ITERS = (A::NB + 3) / 4 }; // four radicand bits per iteration
+      enum { YW = 4 * ITERS };
+      enum { RW = 2 * ITERS }; // root width
+      assert((IW1+1)/2 <= IW2); // Check that output format can accommodate full result
+
+      ap_uint<YW> y;
+      if (A::E >= 0)
+         y = ap_uint<YW>(in_val.range(W1-1,0)) << (A::E >= 0 ? A::E : 0);
+      else
+         y = ap_uint<W1>(in_val.range(W1-1,0)) >> (A::E >= 0 ? 0 : -A::E);
+
+      ap_uint<RW>  q = 0;   // partial root
+      ap_int<RW+6> r = 0;   // partial remainder, always in [0, 2q]
+      RADIX4: for (int i = ITERS - 1; i >= 0; i--) {
+         r = (r << 4) | ap_int<RW+6>(y.range(4*i+3, 4*i));
+         ap_int<RW+6> q8 = ap_int<RW+6>(q) << 3;
+         ap_int<RW+6> t1 = r - (q8 + 1);            // digit 1: 8q + 1
+         ap_int<RW+6> t2 = r - ((q8 << 1) + 4);     // digit 2: 16q + 4
+         ap_int<RW+6> t3 = r - ((q8 << 1) + q8 + 9); // digit 3: 24q + 9
+         if (t3 >= 0) {
+            r = t3;
+            q = (q << 2) | 3;
+         } else if (t2 >= 0) {
+            r = t2;
+            q = (q << 2) | 2;
+         } else if (t1 >= 0) {
+            r = t1;
+            q = (q << 2) | 1;
+         } else {
+            q = q << 2;
+         }
+      }
+      fxp_sqrt_round<RW>(result, q);
+   }
+};
+
+template <>
+struct fxp_sqrt_impl<fxp_sqrt_newton> {
+   template <int W2, int IW2, int W1, int IW1>
+   static void run(ap_ufixed<W2,IW2>& result, ap_ufixed<W1,IW1>& in_val)
+   {
+      typedef fxp_sqrt_aligned<W2,IW2,W1,IW1> A;
+      enum { NBE = (A::NB + (A::NB & 1)) > 8 ? (A::NB + (A::NB & 1)) : 8 }; // even radicand width
+      enum { RW = NBE / 2 }; // root width
+      enum { P = RW + 6 }; // fractional bits carried through the iteration
+      assert((IW1+1)/2 <= IW2); // Check that output format can accommodate full result
+
+      ap_uint<NBE> y;
+      if (A::E >= 0)
+         y = ap_uint<NBE>(in_val.range(W1-1,0)) << (A::E >= 0 ? A::E : 0);
+      else
+         y = ap_uint<W1>(in_val.range(W1-1,0)) >> (A::E >= 0 ? 0 : -A::E);
+      if (y == 0) {
+         result = 0;
+         return;
+      }
+
+      // m = y << z lies in [1/4, 1)
+      int z;
+      ap_uint<P> mp = fxp_sqrt_normalize<P>(y, z);
+      ap_uint<P+1> x = fxp_rsqrt_newton<P>(mp);
+
+      // sqrt(m) = m / sqrt(m); undo the normalization and fix the last ulp
+      ap_uint<P+1> sm = (ap_uint<2*P+1>(mp) * x) >> P;
+      ap_uint<RW+1> r = sm >> (P - RW + z / 2);
+      ap_uint<2*RW+2> sq = ap_uint<2*RW+2>(r) * r;
+      if (sq > y)
+         r = r - 1;
+      else if (sq + (ap_uint<2*RW+2>(r) << 1) + 1 <= y)
+         r = r + 1;
+      fxp_sqrt_round<RW>(result, ap_uint<RW>(r));
+   }
+};
+
+template <typename MODE, int W2, int IW2, int W1, int IW1>
+void fxp_sqrt(ap_ufixed<W2,IW2>& result, ap_ufixed<W1,IW1>& in_val)
+{
+   fxp_sqrt_impl<MODE>::run(result, in_val);
+}
+
+// Fixed point reciprocal square-root templates
+//
+// Basic usage: fxp_rsqrt(result_var, radicand_var);
+//          or: fxp_div_sqrt(result_var, numerator_var, radicand_var);
+// where all variables are ap_ufixed<> and the template parameters are
+// inferred from their types as for fxp_sqrt<>.
+//
+// Description:
+// fxp_rsqrt<> computes 1/sqrt(radicand), and fxp_div_sqrt<> computes
+// numerator/sqrt(radicand) as one fused datapath instead of a square-root
+// followed by a divide, e.g. for the x[i] / sqrt(sum of squares) of vector
+// and layer normalization.  Both normalize the radicand, run the seeded
+// Newton-Raphson iteration of fxp_sqrt_newton on it, scale the reciprocal
+// root by the numerator, and then fix the last bit with an exact integer
+// comparison.  Their results are therefore rounded to nearest (ties up)
+// with the same guarantee as fxp_sqrt<>, as long as the output format can
+// hold them; results beyond the output format, and a zero radicand,
+// saturate.  All formats must have non-negative integer and fractional
+// widths.
+
+template <int W2, int IW2, int WX, int IWX, int W1, int IW1>
+void fxp_div_sqrt(ap_ufixed<W2,IW2>& result, ap_ufixed<WX,IWX>& x, ap_ufixed<W1,IW1>& in_val)
+{
+   static_assert(0 <= IW2 && IW2 <= W2 && 0 <= IWX && IWX <= WX && 0 <= IW1 && IW1 <= W1,
+                 "fxp_div_sqrt: formats must have non-negative integer and fractional widths");
+   enum { FX = WX - IWX };
+   enum { G = W2 - IW2 + 1 }; // fractional bits of the result before rounding
+   enum { ODD = (W1 - IW1) & 1 };
+   enum { YW = W1 + ODD, FY = W1 - IW1 + ODD }; // radicand with even fractional bits
+   enum { NBE = (YW + (YW & 1)) > 8 ? (YW + (YW & 1)) : 8 }; // even radicand width
+   enum { RW = IWX + G + FY/2 + 1 }; // result width
+   enum { P = RW + 6 }; // fractional bits carried through the iteration
+   // q is exact if q^2 * y <= x^2 * 2^K < (q+1)^2 * y
+   enum { K = 2*G - 2*FX + FY };
+   enum { KL = K < 0 ? -K : 0, KR = K > 0 ? K : 0 };
+   enum { CW = (2*RW + 2 + YW + KL > 2*WX + KR ? 2*RW + 2 + YW + KL : 2*WX + KR) + 1 };
+
+   ap_uint<YW> y = ap_uint<YW>(in_val.range(W1-1,0)) << ODD;
+   ap_uint<WX> xn = x.range(WX-1,0);
+   if (y == 0) {
+      result.range(W2-1,0) = ~ap_uint<W2>(0); // saturate
+      return;
+   }
+
+   // m = y << z lies in [1/4, 1), so that
+   // x / sqrt(y) = x * (1/sqrt(m)) * 2^((z - NBE + FY) / 2 - FX)
+   int z;
+   ap_uint<P> mp = fxp_sqrt_normalize<P>(ap_uint<NBE>(y), z);
+   ap_uint<P+1> r = fxp_rsqrt_newton<P>(mp);
+   int sh = P + FX - G - FY/2 + (NBE - z) / 2; // always positive
+   ap_uint<RW+1> q = (ap_uint<WX+2*P+2>(xn) * r) >> sh;
+
+   typedef ap_uint<CW> wide;
+   wide x2 = (wide(xn) * xn) << KR;
+   wide q2y = (wide(q) * q * y) << KL;
+   wide q1 = wide(q) + 1;
+   wide q12y = (q1 * q1 * y) << KL;
+   if (q2y > x2)
+      q = q - 1;
+   else if (q12y <= x2)
+      q = q + 1;
+   fxp_sqrt_round<RW+1>(result, q);
+}
+
+template <int W2, int IW2, int W1, int IW1>
+void fxp_rsqrt(ap_ufixed<W2,IW2>& result, ap_ufixed<W1,IW1>& in_val)
+{
+   ap_ufixed<1,1> one = 1;
+   fxp_div_sqrt(result, one, in_val);
+}
+
+// Compile-time fixed point square-root
+//
+// Basic usage: fxp_sqrt_const<W1,IW1,RADICAND>(root_var);
+//          or: constexpr unsigned long long bits =
+//                 fxp_sqrt_constexpr<W2,IW2,W1,IW1>(RADICAND);
+// where RADICAND is the raw bit pattern of an ap_ufixed<W1,IW1> constant,
+// which fxp_const_bits<W1,IW1>(value) derives from a literal value using
+// ap_ufixed<>'s default truncation and wrap-around.
+//
+// Description:
+// Folds the non-restoring loop of fxp_sqrt<> at compile time, so roots of
+// constants (normalization factors, filter coefficients) become literals and
+// generate no hardware.  The recurrence is written in C++11 constexpr form
+// over unsigned long long and reproduces every ap_int<> wrap of fxp_sqrt<>,
+// so the result is bit-identical to calling fxp_sqrt<> at run time.  All
+// intermediates, including the QW+2 bit remainder, must fit in 63 bits.
+
+typedef unsigned long long fxp_ce_bits;
+
+constexpr fxp_ce_bits fxp_ce_mask(int n)
+{
+   return n >= 64 ? ~0ULL : (1ULL << n) - 1;
+}
+
+constexpr double fxp_ce_ldexp(double v, int e)
+{
+   return e == 0 ? v : e > 0 ? fxp_ce_ldexp(v * 2.0, e - 1) : fxp_ce_ldexp(v / 2.0, e + 1);
+}
+
+template <int W, int IW>
+constexpr fxp_ce_bits fxp_const_bits(double value)
+{
+   return fxp_ce_bits(fxp_ce_ldexp(value, W - IW)) & fxp_ce_mask(W);
+}
+
+constexpr bool fxp_ce_neg(fxp_ce_bits s, int sw)
+{
+   return (s >> (sw - 1)) & 1;
+}
+
+// Round result by "extra iteration" method, then truncate the excess bit
+constexpr fxp_ce_bits fxp_ce_round(fxp_ce_bits s, fxp_ce_bits q, int sw, int qw, int w2)
+{
+   return (((!fxp_ce_neg(s, sw) && s != 0) ? ((q + 1) & fxp_ce_mask(qw)) : q) >> 1) & fxp_ce_mask(w2);
+}
+
+// Iteration i of the non-restoring loop over (s, q, q_star)
+constexpr fxp_ce_bits fxp_ce_iter(fxp_ce_bits s, fxp_ce_bits q, fxp_ce_bits q_star,
+                                  int i, int root_prec, int sw, int qw, int w2)
+{
+   return i > root_prec
+      ? fxp_ce_round(s, q, sw, qw, w2)
+      : !fxp_ce_neg(s, sw)
+         ? fxp_ce_iter((2 * s - ((((q << 2) & fxp_ce_mask(sw)) | 1) << (root_prec - i))) & fxp_ce_mask(sw),
+                       ((q << 1) | 1) & fxp_ce_mask(qw), (q << 1) & fxp_ce_mask(qw),
+                       i + 1, root_prec, sw, qw, w2)
+         : fxp_ce_iter((2 * s + ((((q_star << 2) & fxp_ce_mask(sw)) | 3) << (root_prec - i))) & fxp_ce_mask(sw),
+                       ((q_star << 1) | 1) & fxp_ce_mask(qw), (q_star << 1) & fxp_ce_mask(qw),
+                       i + 1, root_prec, sw, qw, w2);
+}
+
+// Initial remainder: in << SCALE, or (in >> -SCALE) rounded
+constexpr fxp_ce_bits fxp_ce_scale(fxp_ce_bits in, int scale, int sw)
+{
+   return (scale >= 0
+              ? in << scale
+              : (in >> (-(scale + 1)) >> 1) + ((in >> (-(scale + 1))) & 1))
+          & fxp_ce_mask(sw);
+}
+
+template <int W2, int IW2, int W1, int IW1>
+constexpr fxp_ce_bits fxp_sqrt_constexpr(fxp_ce_bits radicand)
+{
+   static_assert((IW1+1)/2 <= IW2, "fxp_sqrt_constexpr: output format cannot accommodate full result");
+   static_assert((IW1+1)/2 + (W2-IW2) + 4 <= 64 && W1 <= 64,
+                 "fxp_sqrt_constexpr: formats too wide for compile-time evaluation");
+   return fxp_ce_iter(
+      fxp_ce_scale(radicand & fxp_ce_mask(W1),
+                   (W2 - W1) - (IW2 - (IW1+1)/2), // SCALE
+                   (IW1+1)/2 + (W2-IW2) + 3),     // QW+2
+      0, 0, 0,
+      (IW1+1)/2 + (W2-IW2) + 1 - (IW1 % 2),        // ROOT_PREC
+      (IW1+1)/2 + (W2-IW2) + 3,                    // QW+2
+      (IW1+1)/2 + (W2-IW2) + 1,                    // QW
+      W2);
+}
+
+template <int W1, int IW1, fxp_ce_bits RADICAND, int W2, int IW2>
+void fxp_sqrt_const(ap_ufixed<W2,IW2>& result)
+{
+   constexpr fxp_ce_bits root = fxp_sqrt_constexpr<W2,IW2,W1,IW1>(RADICAND);
+   result.range(W2-1,0) = ap_uint<W2>(root);
+}
+
+// Integer square-root, i.e. floor(sqrt(input)).
+// The root is computed with 16 fractional bits and then truncated: with an
+// integer-only root format fxp_sqrt<> would shift the low half of the radicand
+// out of its initial remainder (SCALE < 0) and lose precision.
 ap_uint<32> sqrt(ap_uint<32>& input) {
   ap_ufixed<32,32> input_fxp = ap_ufixed<32,32>(input);
-  ap_ufixed<16,16> input_sqrt_fxp;
+  ap_ufixed<32,16> input_sqrt_fxp;
   fxp_sqrt(input_sqrt_fxp, input_fxp);
-  return (ap_uint<32>)input.to_int();
+  return (ap_uint<32>)input_sqrt_fxp.to_uint();
 }
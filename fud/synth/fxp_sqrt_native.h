@@ -0,0 +1,291 @@
+// Host-side, bit-accurate model of the fxp_sqrt<> template in fxp_sqrt.h
+//
+// Basic usage: fxp_native::fxp_sqrt(root_var, radicand_var);
+//          or: fxp_native::fxp_sqrt<W2,IW2,W1,IW1>(root_var, radicand_var);
+//          or: fxp_native::fxp_sqrt_bulk<W2,IW2,W1,IW1>(roots, radicands, n);
+// where root_var and radicand_var are fxp_native::ufixed<> variables, and
+// roots/radicands are arrays of the raw (unscaled) bit patterns held in
+// ufixed<>::bits_type.
+//
+// Description:
+// This header reproduces, bit for bit, the non-restoring algorithm and the
+// "extra iteration" rounding of fxp_sqrt<> without depending on the Xilinx
+// arbitrary-precision headers, so that golden outputs for large test vectors
+// can be generated on ordinary hosts.  Values are kept in the narrowest of
+// uint32_t, uint64_t or unsigned __int128 that fits the widest intermediate
+// of the recurrence (the QW+2 bit remainder).  Every ap_int<> operation in
+// fxp_sqrt<> wraps modulo its width; the model performs the same operations
+// modulo the same widths, and reads the remainder's sign from bit QW+1.
+//
+// fxp_sqrt_bulk<> processes whole arrays.  When the remainder fits in 32 bits
+// and the host compiler targets AVX-512F (16 lanes) or AVX2 (8 lanes), the
+// recurrence runs on all lanes at once, using a per-lane blend in place of the
+// data-dependent branch.  Leftover elements, and wider formats, use the scalar
+// path.
+
+#ifndef FXP_SQRT_NATIVE_H
+#define FXP_SQRT_NATIVE_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+namespace fxp_native {
+
+// Narrowest native unsigned integer holding at least W bits
+template <int W, bool FITS32 = (W <= 32), bool FITS64 = (W <= 64)>
+struct uint_for;
+template <int W> struct uint_for<W, true, true> { typedef uint32_t type; };
+template <int W> struct uint_for<W, false, true> { typedef uint64_t type; };
+template <int W> struct uint_for<W, false, false> {
+   static_assert(W <= 128, "fxp_native: formats wider than 128 bits are not supported");
+   __extension__ typedef unsigned __int128 type;
+};
+
+// Mask of the low N bits of U (N may equal the width of U)
+template <typename U, int N>
+inline U low_mask()
+{
+   return N >= int(sizeof(U) * 8) ? ~U(0) : (U(1) << (N % int(sizeof(U) * 8))) - 1;
+}
+
+// Native stand-in for ap_ufixed<W,IW>, holding the raw bit pattern
+template <int W, int IW>
+struct ufixed {
+   typedef typename uint_for<W>::type bits_type;
+   bits_type bits;
+
+   ufixed() : bits(0) {}
+   static ufixed from_bits(bits_type b)
+   {
+      ufixed r;
+      r.bits = b & low_mask<bits_type, W>();
+      return r;
+   }
+   double to_double() const
+   {
+      double v = double(bits);
+      for (int i = 0; i < W - IW; i++) v /= 2.0;
+      for (int i = 0; i < IW - W; i++) v *= 2.0;
+      return v;
+   }
+};
+
+// Width math shared with fxp_sqrt<>, plus the storage used by the model
+template <int W2, int IW2, int W1, int IW1>
+struct sqrt_format {
+   enum { QW = (IW1+1)/2 + (W2-IW2) + 1 }; // derive max root width
+   enum { SCALE = (W2 - W1) - (IW2 - (IW1+1)/2) }; // scale (shift) to adj initial remainer value
+   enum { ROOT_PREC = QW - (IW1 % 2) };
+   enum { SW = QW + 2 }; // remainder width
+   // one spare bit above the remainder so that 2*s never wraps the word
+   enum { WORD = (SW + 1 > W1 ? (SW + 1 > W2 ? SW + 1 : W2) : (W1 > W2 ? W1 : W2)) };
+   typedef typename uint_for<WORD>::type word;
+   enum { VECTORIZABLE = (WORD <= 32) };
+};
+
+// Scalar model over raw bits.  Mirrors fxp_sqrt<> line for line.
+template <int W2, int IW2, int W1, int IW1>
+inline typename ufixed<W2,IW2>::bits_type
+fxp_sqrt_bits(typename ufixed<W1,IW1>::bits_type in_bits)
+{
+   typedef sqrt_format<W2,IW2,W1,IW1> F;
+   typedef typename F::word U;
+   const U s_mask = low_mask<U, F::SW>();
+   const U s_sign = U(1) << (F::SW - 1);
+   const U q_mask = low_mask<U, F::QW>();
+
+   U in = U(in_bits) & low_mask<U, W1>();
+   U q      = 0;   // partial sqrt
+   U q_star = 0;   // diminished partial sqrt
+   U s; // scaled remainder initialized to extracted input bits
+   if (F::SCALE >= 0)
+      s = (in << (F::SCALE >= 0 ? F::SCALE : 0)) & s_mask;
+   else {
+      // ((in >> k) + 1) >> 1, written so that it cannot overflow the word
+      const int k = F::SCALE >= 0 ? 0 : -(F::SCALE + 1);
+      s = ((in >> k >> 1) + ((in >> k) & 1)) & s_mask;
+   }
+
+   // Non-restoring square-root algorithm
+   for (int i = 0; i <= F::ROOT_PREC; i++) {
+      if (!(s & s_sign)) {
+         s = (2 * s - ((((q << 2) & s_mask) | 1) << (F::ROOT_PREC - i))) & s_mask;
+         q_star = (q << 1) & q_mask;
+         q = ((q << 1) | 1) & q_mask;
+      } else {
+         s = (2 * s + ((((q_star << 2) & s_mask) | 3) << (F::ROOT_PREC - i))) & s_mask;
+         q = ((q_star << 1) | 1) & q_mask;
+         q_star = (q_star << 1) & q_mask;
+      }
+   }
+   // Round result by "extra iteration" method
+   if (!(s & s_sign) && s != 0)
+      q = (q + 1) & q_mask;
+   // Truncate excess bit and assign to output format
+   return typename ufixed<W2,IW2>::bits_type((q >> 1) & low_mask<U, W2>());
+}
+
+template <int W2, int IW2, int W1, int IW1>
+inline void fxp_sqrt(ufixed<W2,IW2>& result, const ufixed<W1,IW1>& in_val)
+{
+   assert((IW1+1)/2 <= IW2); // Check that output format can accommodate full result
+   result.bits = fxp_sqrt_bits<W2,IW2,W1,IW1>(in_val.bits);
+}
+
+#if defined(__AVX512F__)
+// 16 lanes of the recurrence; requires sqrt_format<>::VECTORIZABLE
+template <int W2, int IW2, int W1, int IW1>
+inline void fxp_sqrt_x16(uint32_t* root, const uint32_t* radicand)
+{
+   typedef sqrt_format<W2,IW2,W1,IW1> F;
+   const __m512i s_mask = _mm512_set1_epi32(int(low_mask<uint32_t, F::SW>()));
+   const __m512i s_sign = _mm512_set1_epi32(int(uint32_t(1) << (F::SW - 1)));
+   const __m512i q_mask = _mm512_set1_epi32(int(low_mask<uint32_t, F::QW>()));
+   const __m512i one = _mm512_set1_epi32(1);
+   const __m512i three = _mm512_set1_epi32(3);
+
+   __m512i in = _mm512_and_si512(
+      _mm512_loadu_si512(radicand),
+      _mm512_set1_epi32(int(low_mask<uint32_t, W1>())));
+   __m512i s;
+   if (F::SCALE >= 0)
+      s = _mm512_sllv_epi32(in, _mm512_set1_epi32(F::SCALE >= 0 ? F::SCALE : 0));
+   else {
+      const __m512i k = _mm512_set1_epi32(F::SCALE >= 0 ? 0 : -(F::SCALE + 1));
+      const __m512i t = _mm512_srlv_epi32(in, k);
+      s = _mm512_add_epi32(_mm512_srli_epi32(t, 1), _mm512_and_si512(t, one));
+   }
+   s = _mm512_and_si512(s, s_mask);
+   __m512i q = _mm512_setzero_si512();
+   __m512i q_star = _mm512_setzero_si512();
+
+   for (int i = 0; i <= F::ROOT_PREC; i++) {
+      const __m512i sh = _mm512_set1_epi32(F::ROOT_PREC - i);
+      const __mmask16 neg = _mm512_test_epi32_mask(s, s_sign);
+      const __m512i sub = _mm512_sllv_epi32(
+         _mm512_or_si512(_mm512_and_si512(_mm512_slli_epi32(q, 2), s_mask), one), sh);
+      const __m512i add = _mm512_sllv_epi32(
+         _mm512_or_si512(_mm512_and_si512(_mm512_slli_epi32(q_star, 2), s_mask), three), sh);
+      const __m512i s2 = _mm512_slli_epi32(s, 1);
+      s = _mm512_mask_blend_epi32(neg, _mm512_sub_epi32(s2, sub), _mm512_add_epi32(s2, add));
+      s = _mm512_and_si512(s, s_mask);
+      // both branches shift the same selected value: q when s >= 0, else q_star
+      const __m512i sel = _mm512_mask_blend_epi32(neg, q, q_star);
+      q_star = _mm512_and_si512(_mm512_slli_epi32(sel, 1), q_mask);
+      q = _mm512_and_si512(_mm512_or_si512(_mm512_slli_epi32(sel, 1), one), q_mask);
+   }
+   const __mmask16 round = _mm512_kandn(_mm512_test_epi32_mask(s, s_sign),
+                                        _mm512_test_epi32_mask(s, s));
+   q = _mm512_and_si512(_mm512_mask_add_epi32(q, round, q, one), q_mask);
+   q = _mm512_and_si512(_mm512_srli_epi32(q, 1),
+                        _mm512_set1_epi32(int(low_mask<uint32_t, W2>())));
+   _mm512_storeu_si512(root, q);
+}
+#endif
+
+#if defined(__AVX2__)
+// 8 lanes of the recurrence; requires sqrt_format<>::VECTORIZABLE
+template <int W2, int IW2, int W1, int IW1>
+inline void fxp_sqrt_x8(uint32_t* root, const uint32_t* radicand)
+{
+   typedef sqrt_format<W2,IW2,W1,IW1> F;
+   const __m256i s_mask = _mm256_set1_epi32(int(low_mask<uint32_t, F::SW>()));
+   const __m256i s_sign = _mm256_set1_epi32(int(uint32_t(1) << (F::SW - 1)));
+   const __m256i q_mask = _mm256_set1_epi32(int(low_mask<uint32_t, F::QW>()));
+   const __m256i zero = _mm256_setzero_si256();
+   const __m256i one = _mm256_set1_epi32(1);
+   const __m256i three = _mm256_set1_epi32(3);
+
+   __m256i in = _mm256_and_si256(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(radicand)),
+      _mm256_set1_epi32(int(low_mask<uint32_t, W1>())));
+   __m256i s;
+   if (F::SCALE >= 0)
+      s = _mm256_sll_epi32(in, _mm_cvtsi32_si128(F::SCALE >= 0 ? F::SCALE : 0));
+   else {
+      const __m128i k = _mm_cvtsi32_si128(F::SCALE >= 0 ? 0 : -(F::SCALE + 1));
+      const __m256i t = _mm256_srl_epi32(in, k);
+      s = _mm256_add_epi32(_mm256_srli_epi32(t, 1), _mm256_and_si256(t, one));
+   }
+   s = _mm256_and_si256(s, s_mask);
+   __m256i q = zero;
+   __m256i q_star = zero;
+
+   for (int i = 0; i <= F::ROOT_PREC; i++) {
+      const __m128i sh = _mm_cvtsi32_si128(F::ROOT_PREC - i);
+      const __m256i neg = _mm256_cmpeq_epi32(_mm256_and_si256(s, s_sign), s_sign);
+      const __m256i sub = _mm256_sll_epi32(
+         _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi32(q, 2), s_mask), one), sh);
+      const __m256i add = _mm256_sll_epi32(
+         _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi32(q_star, 2), s_mask), three), sh);
+      const __m256i s2 = _mm256_slli_epi32(s, 1);
+      s = _mm256_blendv_epi8(_mm256_sub_epi32(s2, sub), _mm256_add_epi32(s2, add), neg);
+      s = _mm256_and_si256(s, s_mask);
+      // both branches shift the same selected value: q when s >= 0, else q_star
+      const __m256i sel = _mm256_blendv_epi8(q, q_star, neg);
+      q_star = _mm256_and_si256(_mm256_slli_epi32(sel, 1), q_mask);
+      q = _mm256_and_si256(_mm256_or_si256(_mm256_slli_epi32(sel, 1), one), q_mask);
+   }
+   // round when s > 0, i.e. sign bit clear and s non-zero
+   const __m256i nonpos = _mm256_or_si256(
+      _mm256_cmpeq_epi32(_mm256_and_si256(s, s_sign), s_sign),
+      _mm256_cmpeq_epi32(s, zero));
+   q = _mm256_add_epi32(q, _mm256_andnot_si256(nonpos, one));
+   q = _mm256_and_si256(q, q_mask);
+   q = _mm256_and_si256(_mm256_srli_epi32(q, 1),
+                        _mm256_set1_epi32(int(low_mask<uint32_t, W2>())));
+   _mm256_storeu_si256(reinterpret_cast<__m256i*>(root), q);
+}
+#endif
+
+// Dispatch to the vector kernels when the format allows it
+template <int W2, int IW2, int W1, int IW1, bool VECTOR = sqrt_format<W2,IW2,W1,IW1>::VECTORIZABLE>
+struct bulk_kernel {
+   static size_t run(typename ufixed<W2,IW2>::bits_type*,
+                     const typename ufixed<W1,IW1>::bits_type*, size_t)
+   {
+      return 0;
+   }
+};
+
+template <int W2, int IW2, int W1, int IW1>
+struct bulk_kernel<W2,IW2,W1,IW1,true> {
+   // Returns the number of leading elements processed
+   static size_t run(uint32_t* root, const uint32_t* radicand, size_t n)
+   {
+      size_t i = 0;
+#if defined(__AVX512F__)
+      for (; i + 16 <= n; i += 16)
+         fxp_sqrt_x16<W2,IW2,W1,IW1>(root + i, radicand + i);
+#endif
+#if defined(__AVX2__)
+      for (; i + 8 <= n; i += 8)
+         fxp_sqrt_x8<W2,IW2,W1,IW1>(root + i, radicand + i);
+#endif
+      (void)root;
+      (void)radicand;
+      (void)n;
+      return i;
+   }
+};
+
+// Compute n roots of raw radicand bit patterns
+template <int W2, int IW2, int W1, int IW1>
+inline void fxp_sqrt_bulk(typename ufixed<W2,IW2>::bits_type* root,
+                          const typename ufixed<W1,IW1>::bits_type* radicand,
+                          size_t n)
+{
+   assert((IW1+1)/2 <= IW2); // Check that output format can accommodate full result
+   size_t i = bulk_kernel<W2,IW2,W1,IW1>::run(root, radicand, n);
+   for (; i < n; i++)
+      root[i] = fxp_sqrt_bits<W2,IW2,W1,IW1>(radicand[i]);
+}
+
+} // namespace fxp_native
+
+#endif // FXP_SQRT_NATIVE_H
@@ -0,0 +1,111 @@
+// Checks fxp_sqrt_native.h: fxp_sqrt_bulk<>, which uses the AVX2 and
+// AVX-512F kernels when they are compiled in, against the scalar model, and
+// the scalar model against roots computed by hand.  The output doesn't
+// depend on which kernels are compiled in.
+
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+
+#include "fxp_sqrt_native.h"
+
+using namespace fxp_native;
+
+static int failures = 0;
+
+// xorshift64, so that every build sees the same radicands
+static uint64_t next_random()
+{
+   static uint64_t x = 0x9E3779B97F4A7C15ull;
+   x ^= x << 13;
+   x ^= x >> 7;
+   x ^= x << 17;
+   return x;
+}
+
+// Every radicand if there are at most 2^16 of them, and otherwise the edge
+// cases and an odd number of random ones, so that the vector loops leave a
+// tail for the scalar path
+template <int W2, int IW2, int W1, int IW1>
+void check_bulk()
+{
+   typedef typename ufixed<W1,IW1>::bits_type in_t;
+   typedef typename ufixed<W2,IW2>::bits_type out_t;
+   std::vector<in_t> radicands;
+   if (W1 <= 16) {
+      for (uint32_t b = 0; b < (1u << W1); b++)
+         radicands.push_back(in_t(b));
+   } else {
+      radicands.push_back(0);
+      radicands.push_back(1);
+      for (int i = 0; i < W1; i++)
+         radicands.push_back(in_t(1) << i);
+      radicands.push_back(ufixed<W1,IW1>::from_bits(~in_t(0)).bits);
+      while (radicands.size() < 100003) {
+         in_t b = in_t(next_random());
+         if (W1 > 64)
+            b = (b << 32 << 32) | in_t(next_random());
+         radicands.push_back(ufixed<W1,IW1>::from_bits(b).bits);
+      }
+   }
+
+   std::vector<out_t> roots(radicands.size());
+   fxp_sqrt_bulk<W2,IW2,W1,IW1>(roots.data(), radicands.data(), radicands.size());
+   size_t mismatches = 0;
+   for (size_t i = 0; i < radicands.size(); i++)
+      if (roots[i] != fxp_sqrt_bits<W2,IW2,W1,IW1>(radicands[i]))
+         mismatches++;
+   if (mismatches)
+      failures++;
+   printf("<%d,%d> -> <%d,%d>: %zu of %zu bulk roots differ from the scalar model\n",
+          W1, IW1, W2, IW2, mismatches, radicands.size());
+}
+
+// The root of `radicand`, both given as raw bits
+template <int W2, int IW2, int W1, int IW1>
+void check_root(const char* what, typename ufixed<W1,IW1>::bits_type radicand,
+                typename ufixed<W2,IW2>::bits_type expected)
+{
+   ufixed<W2,IW2> root;
+   fxp_sqrt(root, ufixed<W1,IW1>::from_bits(radicand));
+   if (root.bits != expected) {
+      failures++;
+      printf("sqrt(%s) in <%d,%d> -> <%d,%d> is wrong\n", what, W1, IW1, W2, IW2);
+   }
+}
+
+int main()
+{
+   // the remainder fits in 32 bits, so these use the vector kernels
+   check_bulk<16,8,16,8>();
+   check_bulk<10,5,9,9>();
+   check_bulk<12,6,12,4>();
+   check_bulk<16,16,32,32>();
+   check_bulk<24,12,24,12>();
+   check_bulk<32,16,32,16>();
+   // scalar only, on uint64_t and unsigned __int128
+   check_bulk<48,24,48,24>();
+   check_bulk<96,48,96,48>();
+
+   typedef unsigned __int128 u128;
+   check_root<16,8,16,8>("4", 0x400, 0x200);
+   check_root<16,8,16,8>("2", 0x200, 0x16a);
+   check_root<16,8,16,8>("3", 0x300, 0x1bb);
+   check_root<16,8,16,8>("2.25", 0x240, 0x180);
+   check_root<16,8,16,8>("0.25", 0x40, 0x80);
+   check_root<16,8,16,8>("144", 0x9000, 0xc00);
+   check_root<16,16,32,32>("65536", 0x10000, 0x100);
+   check_root<16,16,32,32>("65535^2", 0xfffe0001u, 0xffff);
+   check_root<24,12,24,12>("2", 0x2000, 0x16a1);
+   check_root<24,12,24,12>("0.5", 0x800, 0xb50);
+   check_root<32,16,32,16>("2", 0x20000, 0x16a0a);
+   check_root<32,16,32,16>("10000", 0x27100000u, 0x640000);
+   check_root<32,16,32,16>("0.0625", 0x1000, 0x4000);
+   check_root<48,24,48,24>("2", 0x2000000ull, 0x16a09e6ull);
+   check_root<48,24,48,24>("3", 0x3000000ull, 0x1bb67afull);
+   check_root<48,24,48,24>("10^6", 0xf4240000000ull, 0x3e8000000ull);
+   check_root<96,48,96,48>("2", 0x2000000000000ull, 0x16a09e667f3bdull);
+   check_root<96,48,96,48>("10^12", u128(0xe8d4a51) << 60, u128(0xf4240) << 48);
+   printf("%d failures\n", failures);
+   return failures != 0;
+}
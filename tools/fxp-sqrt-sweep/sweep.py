@@ -0,0 +1,296 @@
+"""
+Sweep the fixed-point square roots over widths and implementations.
+
+For every width configuration, this synthesizes the `fxp_sqrt` HLS template
+(`fud/synth/fxp_sqrt.h`) in each requested mode through `fud/synth/hls.tcl`,
+and the matching Calyx `fp_sqrt` (or `sqrt`, for integer formats) primitive
+from `primitives/math.sv` through `fud/synth/synth.tcl`. Points run
+concurrently, and the results are collected into one table.
+
+Usage (from the root of the repository):
+
+    python3 tools/fxp-sqrt-sweep/sweep.py \\
+        --widths 16,8 32,16 32,32 --modes nonrestoring pipelined:1 radix4 \\
+        --jobs 4 --out sweep-out
+
+Each point gets a directory under `--out` with its inputs, the raw Vivado
+output, and the extracted estimate. Enable the Vivado result cache
+(`stages.vivado-hls.cache_dir` and `stages.synth-verilog.cache_dir`) to skip
+points that were already synthesized by an earlier sweep.
+"""
+
+import argparse
+import json
+import os
+import shutil
+import subprocess
+import sys
+import threading
+from concurrent.futures import ThreadPoolExecutor
+from pathlib import Path
+
+# The HLS kernel for one point. The s_axilite interface is what
+# `hls-estimate` subtracts from the totals.
+KERNEL = """\
+#include "fxp_sqrt.h"
+
+typedef ap_ufixed<{w1},{iw1}> radicand_t;
+typedef ap_ufixed<{w2},{iw2}> root_t;
+
+void kernel(radicand_t in, root_t &out) {{
+#pragma HLS INTERFACE s_axilite port=in
+#pragma HLS INTERFACE s_axilite port=out
+#pragma HLS INTERFACE s_axilite port=return
+  radicand_t x = in;
+  root_t r;
+  {call}
+  out = r;
+}}
+"""
+
+# How each HLS mode calls the template
+CALLS = {
+    "nonrestoring": "fxp_sqrt(r, x);",
+    "pipelined": "fxp_sqrt_pipelined<{arg}>(r, x);",
+    "radix4": "fxp_sqrt<fxp_sqrt_radix4>(r, x);",
+    "newton": "fxp_sqrt<fxp_sqrt_newton>(r, x);",
+    # the reciprocal, fused and as a square root followed by a divide
+    "rsqrt": "fxp_rsqrt(r, x);",
+    "sqrt_div": "root_t s; fxp_sqrt(s, x); r = root_t(1) / s;",
+}
+
+# A Calyx design that computes one root with the given primitive.
+CALYX = """\
+import "primitives/core.futil";
+import "primitives/math.futil";
+
+component main(in: {w}) -> (out: {w}) {{
+  cells {{
+    s = {primitive};
+    r = std_reg({w});
+  }}
+  wires {{
+    group compute {{
+      s.in = in;
+      s.go = !s.done ? 1'd1;
+      r.in = s.out;
+      r.write_en = s.done;
+      compute[done] = r.done;
+    }}
+    out = r.out;
+  }}
+  control {{
+    compute;
+  }}
+}}
+"""
+
+COLUMNS = ["point", "lut", "ff", "dsp", "latency", "ii", "fmax"]
+
+
+class Point:
+    """One design to synthesize"""
+
+    def __init__(self, kind, mode, w1, iw1, w2, iw2):
+        self.kind = kind
+        self.mode = mode
+        self.w1, self.iw1, self.w2, self.iw2 = w1, iw1, w2, iw2
+
+    @property
+    def name(self):
+        mode = self.mode.replace(":", "")
+        widths = f"{self.w2}.{self.iw2}-{self.w1}.{self.iw1}"
+        return f"{self.kind}-{mode}-{widths}"
+
+
+def parse_widths(spec):
+    """
+    Parse `W1,IW1[,W2,IW2]`: the radicand format, and optionally the root
+    format, which defaults to the radicand's (as Calyx's `fp_sqrt` uses).
+    """
+    widths = [int(w) for w in spec.split(",")]
+    if len(widths) == 2:
+        widths += widths
+    if len(widths) != 4:
+        raise argparse.ArgumentTypeError(f"Expected W1,IW1[,W2,IW2], got `{spec}'")
+    return tuple(widths)
+
+
+def points(args):
+    for w1, iw1, w2, iw2 in args.widths:
+        for mode in args.modes:
+            yield Point("hls", mode, w1, iw1, w2, iw2)
+        if not args.no_calyx:
+            # the Calyx primitives produce a root in the radicand's format
+            if (w1, iw1) != (w2, iw2):
+                continue
+            mode = "sqrt" if iw1 == w1 else "fp_sqrt"
+            yield Point("calyx", mode, w1, iw1, w2, iw2)
+
+
+def fud(args, *cmd):
+    """Run fud, returning its stdout."""
+    overrides = [f for setting in args.set for f in ("-s", *setting)]
+    return subprocess.run(
+        [args.fud, "e", *map(str, cmd), *overrides],
+        check=True,
+        stdout=subprocess.PIPE,
+        text=True,
+    ).stdout
+
+
+def synthesize(args, point, licenses):
+    """
+    Synthesize `point` and return its row of the table, or the error that
+    stopped it.
+    """
+    out = args.out / point.name
+    out.mkdir(parents=True, exist_ok=True)
+    raw = out / "vivado"
+    # fud moves its output directory to `raw`, which must not exist yet
+    shutil.rmtree(raw, ignore_errors=True)
+    try:
+        if point.kind == "hls":
+            mode, _, arg = point.mode.partition(":")
+            call = CALLS[mode].format(arg=arg or 1)
+            src = out / "kernel.cpp"
+            w1, iw1, w2, iw2 = point.w1, point.iw1, point.w2, point.iw2
+            src.write_text(KERNEL.format(w1=w1, iw1=iw1, w2=w2, iw2=iw2, call=call))
+            files, estimate = (
+                ("hls-files-routed", "hls-detailed-estimate")
+                if args.impl
+                else ("hls-files", "hls-estimate")
+            )
+            with licenses:
+                fud(args, src, "--from", "vivado-hls", "--to", files, "-o", raw)
+            result = json.loads(fud(args, raw, "--from", files, "--to", estimate))
+            if args.impl:
+                # place and route doesn't report the HLS schedule
+                schedule = fud(args, raw, "--from", "hls-files", "--to", "hls-estimate")
+                result.update(json.loads(schedule))
+        else:
+            if point.mode == "sqrt":
+                primitive = f"sqrt({point.w1})"
+            else:
+                frac = point.w1 - point.iw1
+                primitive = f"fp_sqrt({point.w1}, {point.iw1}, {frac})"
+            src = out / "main.futil"
+            src.write_text(CALYX.format(w=point.w1, primitive=primitive))
+            with licenses:
+                fud(args, src, "--to", "synth-files", "-o", raw)
+            result = json.loads(
+                fud(args, raw, "--from", "synth-files", "--to", "resource-estimate")
+            )
+            # the primitive spends one cycle starting, and then retires two
+            # radicand bits per cycle; it isn't pipelined
+            ext_width = point.w1 + (point.iw1 & 1)
+            frac = 0 if point.mode == "sqrt" else point.w1 - point.iw1
+            result["latency"] = result["ii"] = (ext_width + frac) // 2 + 1
+    except subprocess.CalledProcessError as e:
+        return {"point": point.name, "error": f"fud exited with {e.returncode}"}
+    (out / "estimate.json").write_text(json.dumps(result, indent=2))
+    return row(point, result)
+
+
+def row(point, result):
+    """Pick the columns of the table out of an estimate."""
+    fmax = None
+    if "period" in result and "worst_slack" in result:
+        achieved = result["period"] - result["worst_slack"]
+        fmax = round(1000 / achieved, 1) if achieved > 0 else None
+    return {
+        "point": point.name,
+        "lut": result.get("lut"),
+        "ff": result.get("ff", result.get("clb_registers")),
+        "dsp": result.get("dsp"),
+        "latency": result.get("latency", result.get("worst_latency")),
+        "ii": result.get("ii"),
+        "fmax": fmax,
+    }
+
+
+def print_table(rows):
+    cells = [COLUMNS] + [
+        [str(r[c]) if r.get(c) is not None else "-" for c in COLUMNS]
+        if "error" not in r
+        else [r["point"], r["error"]]
+        for r in rows
+    ]
+    widths = [
+        max(len(c[i]) for c in cells if i < len(c)) for i in range(len(COLUMNS))
+    ]
+    for c in cells:
+        print("  ".join(v.ljust(w) for v, w in zip(c, widths)).rstrip())
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument(
+        "--widths",
+        nargs="+",
+        type=parse_widths,
+        default=[(8, 4, 8, 4), (16, 8, 16, 8), (32, 16, 32, 16), (32, 32, 32, 32)],
+        metavar="W1,IW1[,W2,IW2]",
+        help="formats of the radicand and root",
+    )
+    parser.add_argument(
+        "--modes",
+        nargs="+",
+        default=["nonrestoring", "pipelined:1", "radix4", "newton"],
+        metavar="MODE",
+        help="HLS modes: nonrestoring, pipelined:ITERS_PER_STAGE, radix4, newton, "
+        "rsqrt, sqrt_div",
+    )
+    parser.add_argument(
+        "--no-calyx", action="store_true", help="skip the Calyx primitives"
+    )
+    parser.add_argument(
+        "--impl",
+        action="store_true",
+        help="place and route the HLS designs too, for their registers and Fmax",
+    )
+    parser.add_argument(
+        "-j",
+        "--jobs",
+        type=int,
+        default=os.cpu_count() or 1,
+        help="points to work on at once",
+    )
+    parser.add_argument(
+        "--licenses",
+        type=int,
+        default=None,
+        help="Vivado runs at once (defaults to --jobs)",
+    )
+    parser.add_argument(
+        "-s",
+        "--set",
+        nargs=2,
+        action="append",
+        default=[],
+        metavar=("KEY", "VALUE"),
+        help="fud configuration override, passed through to every run",
+    )
+    parser.add_argument("--fud", default="fud", help="fud executable")
+    parser.add_argument("--out", type=Path, default=Path("fxp-sqrt-sweep"))
+    parser.add_argument("--json", type=Path, help="also write the table as JSON")
+    args = parser.parse_args()
+
+    for mode in args.modes:
+        if mode.partition(":")[0] not in CALLS:
+            parser.error(f"Unknown mode `{mode}'")
+
+    licenses = threading.BoundedSemaphore(args.licenses or args.jobs)
+    todo = list(points(args))
+    with ThreadPoolExecutor(max_workers=args.jobs) as pool:
+        rows = list(pool.map(lambda p: synthesize(args, p, licenses), todo))
+
+    print_table(rows)
+    if args.json:
+        args.json.write_text(json.dumps(rows, indent=2))
+    if any("error" in r for r in rows):
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()